@@ -31,12 +31,17 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
 #include <math.h>
 
 #include "buffer.h"
+#include "hash.h"
+#include "overview.h"
 
 static const char *INTERNAL_NAME = "lhc.buffer";
 
@@ -690,6 +695,19 @@ static int lhc_buffer_clone(lua_State *L)
 	return lhc_buffer_new(L);
 }
 
+/* buf:hash([seed]) -- 64 bit hash of the samples as hex string */
+static int lhc_buffer_hash(lua_State *L)
+{
+	float *buf    = lhc_checkbuffer(L, 1);
+	uint64_t seed = (uint64_t)luaL_optinteger(L, 2, 0);
+	uint64_t h    = lhc_hash64(buf, lua_objlen(L, 1), seed);
+
+	char hex[17];
+	snprintf(hex, sizeof hex, "%016llx", (unsigned long long)h);
+	lua_pushstring(L, hex);
+	return 1;
+}
+
 int lhc_buffer_new(lua_State *L)
 {
 	int type = lua_type(L, 1);
@@ -813,14 +831,169 @@ int lhc_buffer_new(lua_State *L)
 
 		lua_pushcfunction(L, lhc_buffer_clone);
 		lua_setfield(L, -2, "clone");
+
+		lua_pushcfunction(L, lhc_buffer_overview);
+		lua_setfield(L, -2, "overview");
+
+		lua_pushcfunction(L, lhc_buffer_save);
+		lua_setfield(L, -2, "save");
+
+		lua_pushcfunction(L, lhc_buffer_hash);
+		lua_setfield(L, -2, "hash");
 	}
 	lua_setmetatable(L, -2);
 
 	return 1;
 }
 
+/*
+ * native file format: a 64 byte header followed by raw samples in host
+ * byte order. The checksum is lhc_hash64 of the sample data.
+ */
+#define BUFFER_FILE_MAGIC   "LHCBUF\0\0"
+#define BUFFER_FILE_VERSION 1
+#define BUFFER_FILE_FLOAT32 1
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t sampletype;
+	uint32_t samplerate;
+	uint32_t channels;
+	uint64_t nsamples;
+	uint64_t checksum;
+	uint64_t offset;
+	char     tag[16];     /* free for use by the caller, e.g. lhc.memo */
+} BufferFileHeader;
+
+/* buf:save(path [, rate, channels, tag]) */
+int lhc_buffer_save(lua_State *L)
+{
+	float *buf       = lhc_checkbuffer(L, 1);
+	const char *path = luaL_checkstring(L, 2);
+	size_t n         = lhc_buffer_nsamples(L, 1);
+	size_t taglen;
+	const char *tag  = luaL_optlstring(L, 5, "", &taglen);
+
+	BufferFileHeader h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, BUFFER_FILE_MAGIC, sizeof h.magic);
+	h.version    = BUFFER_FILE_VERSION;
+	h.sampletype = BUFFER_FILE_FLOAT32;
+	h.samplerate = luaL_optinteger(L, 3, 44100);
+	h.channels   = luaL_optinteger(L, 4, 1);
+	h.nsamples   = n;
+	h.checksum   = lhc_hash64(buf, n * sizeof(float), 0);
+	h.offset     = sizeof h;
+	if (taglen > sizeof h.tag)
+		return luaL_argerror(L, 5, "tag is longer than 16 bytes");
+	memcpy(h.tag, tag, taglen);
+
+	FILE *f = fopen(path, "wb");
+	if (NULL == f)
+		return luaL_error(L, "Cannot open `%s' for writing", path);
+
+	int ok = 1 == fwrite(&h, sizeof h, 1, f) && n == fwrite(buf, sizeof(float), n, f);
+	ok = (0 == fclose(f)) && ok;
+	if (!ok)
+		return luaL_error(L, "Error writing `%s'", path);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* lhc.buffer.load(path [, verify]) -- buffer, sample rate, channels and tag.
+ * The header is always checked against the file size; the checksum over
+ * the samples only if verify is true. */
+int lhc_buffer_load(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	int verify       = lua_toboolean(L, 2);
+
+	FILE *f = fopen(path, "rb");
+	if (NULL == f)
+		return luaL_error(L, "Cannot open `%s' for reading", path);
+
+	BufferFileHeader h;
+	if (1 != fread(&h, sizeof h, 1, f) || 0 != memcmp(h.magic, BUFFER_FILE_MAGIC, sizeof h.magic))
+	{
+		fclose(f);
+		return luaL_error(L, "`%s' is not a buffer file", path);
+	}
+
+	if (BUFFER_FILE_VERSION != h.version || BUFFER_FILE_FLOAT32 != h.sampletype
+			|| h.offset < sizeof h || h.offset > LONG_MAX)
+	{
+		fclose(f);
+		return luaL_error(L, "Unsupported buffer file: `%s'", path);
+	}
+
+	/* the header must describe exactly the data in the file, or the
+	 * allocation below could be smaller than what is read into it */
+	long size = -1;
+	if (0 == fseek(f, 0, SEEK_END))
+		size = ftell(f);
+	if (size < 0 || (uint64_t)size < h.offset
+			|| h.nsamples > SIZE_MAX / sizeof(float)
+			|| h.nsamples != ((uint64_t)size - h.offset) / sizeof(float)
+			|| 0 != ((uint64_t)size - h.offset) % sizeof(float)
+			|| 0 != fseek(f, (long)h.offset, SEEK_SET))
+	{
+		fclose(f);
+		return luaL_error(L, "Corrupt buffer file: `%s'", path);
+	}
+
+	/* samples are read straight into the new buffer */
+	size_t n   = (size_t)h.nsamples;
+	float *buf = (float *)lua_newuserdata(L, n * sizeof(float));
+	size_t got = fread(buf, sizeof(float), n, f);
+	fclose(f);
+
+	if (got != n)
+		return luaL_error(L, "`%s' is truncated: expected %lu samples, found %lu", path, n, got);
+	if (verify && lhc_hash64(buf, n * sizeof(float), 0) != h.checksum)
+		return luaL_error(L, "Checksum mismatch in `%s'", path);
+
+	luaL_getmetatable(L, INTERNAL_NAME);
+	if (lua_isnil(L, -1))
+	{
+		/* metatable is created along with the first buffer */
+		lua_pop(L, 1);
+		lua_pushcfunction(L, lhc_buffer_new);
+		lua_pushinteger(L, 0);
+		lua_call(L, 1, 1);
+		lua_getmetatable(L, -1);
+		lua_remove(L, -2);
+	}
+	lua_setmetatable(L, -2);
+
+	lua_pushinteger(L, h.samplerate);
+	lua_pushinteger(L, h.channels);
+	lua_pushlstring(L, h.tag, sizeof h.tag);
+	return 4;
+}
+
+/* lhc.buffer(...) */
+static int lhc_buffer___call(lua_State *L)
+{
+	lua_remove(L, 1);
+	return lhc_buffer_new(L);
+}
+
 int luaopen_lhc_buffer(lua_State *L)
 {
+	lua_createtable(L, 0, 2);
+
+	lua_pushcfunction(L, lhc_buffer_load);
+	lua_setfield(L, -2, "load");
+
 	lua_pushcfunction(L, lhc_buffer_new);
+	lua_setfield(L, -2, "new");
+
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lhc_buffer___call);
+	lua_setfield(L, -2, "__call");
+	lua_setmetatable(L, -2);
+
 	return 1;
 }
@@ -38,6 +38,10 @@ int lua_isbuffer(lua_State *L, int idx);
 float *lhc_checkbuffer(lua_State *L, int idx);
 #define lhc_buffer_nsamples(L, idx) (lua_objlen(L, idx) / sizeof(float))
 int lhc_buffer_new(lua_State *L);
+/* buf:save(path [, rate, channels, tag]) -- tag: up to 16 bytes stored in the header */
+int lhc_buffer_save(lua_State *L);
+/* lhc.buffer.load(path [, verify]) -- buffer, rate, channels and tag */
+int lhc_buffer_load(lua_State *L);
 int luaopen_lhc_buffer(lua_State *L);
 
 #ifdef __cplusplus
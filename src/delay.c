@@ -0,0 +1,396 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "delay.h"
+
+static const char *INTERNAL_NAME = "lhc.delay-line";
+
+typedef struct {
+	size_t mask;
+	size_t pos;
+	float  data[];
+} DelayLine;
+
+inline static size_t next_pow2(size_t n)
+{
+	size_t p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+inline static float clamp_delay(const DelayLine *dl, float d)
+{
+	if (d < 1.0f)
+		return 1.0f;
+	if (d > (float)dl->mask)
+		return (float)dl->mask;
+	return d;
+}
+
+/* d = 1 is the most recently pushed sample */
+inline static float delay_tap(const DelayLine *dl, float d)
+{
+	size_t n   = (size_t)d;
+	float frac = d - (float)n;
+	float a    = dl->data[(dl->pos - n) & dl->mask];
+	float b    = dl->data[(dl->pos - n - 1) & dl->mask];
+	return a + frac * (b - a);
+}
+
+inline static void delay_push(DelayLine *dl, float x)
+{
+	dl->data[dl->pos & dl->mask] = x;
+	dl->pos = (dl->pos + 1) & dl->mask;
+}
+
+static DelayLine *lhc_checkdelay(lua_State *L, int idx)
+{
+	return (DelayLine *)luaL_checkudata(L, idx, INTERNAL_NAME);
+}
+
+static int lhc_delay___len(lua_State *L)
+{
+	DelayLine *dl = lhc_checkdelay(L, 1);
+	lua_pushinteger(L, dl->mask);
+	return 1;
+}
+
+static int lhc_delay_push(lua_State *L)
+{
+	DelayLine *dl = lhc_checkdelay(L, 1);
+	int n = lua_gettop(L);
+	for (int i = 2; i <= n; ++i)
+		delay_push(dl, (float)luaL_checknumber(L, i));
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_delay_tap(lua_State *L)
+{
+	DelayLine *dl = lhc_checkdelay(L, 1);
+	int n = lua_gettop(L);
+	luaL_checkstack(L, n, "too many taps requested");
+	for (int i = 2; i <= n; ++i)
+	{
+		float d = clamp_delay(dl, (float)luaL_checknumber(L, i));
+		lua_pushnumber(L, delay_tap(dl, d));
+	}
+	return n - 1;
+}
+
+static int lhc_delay_clear(lua_State *L)
+{
+	DelayLine *dl = lhc_checkdelay(L, 1);
+	memset(dl->data, 0, (dl->mask + 1) * sizeof(float));
+	dl->pos = 0;
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* dl:process(buffer, delay [, feedback [, mix]])
+ * delay may be a number or a buffer of per-sample delays */
+static int lhc_delay_process(lua_State *L)
+{
+	DelayLine *dl  = lhc_checkdelay(L, 1);
+	float *in      = lhc_checkbuffer(L, 2);
+	size_t size    = lhc_buffer_nsamples(L, 2);
+	float feedback = (float)luaL_optnumber(L, 4, 0.);
+	float mix      = (float)luaL_optnumber(L, 5, 1.);
+
+	float *mod      = NULL;
+	size_t size_mod = 0;
+	float d         = 1.0f;
+	if (lua_isbuffer(L, 3))
+	{
+		mod      = (float *)lua_touserdata(L, 3);
+		size_mod = lhc_buffer_nsamples(L, 3);
+	}
+	else
+		d = clamp_delay(dl, (float)luaL_checknumber(L, 3));
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, size);
+	lua_call(L, 1, 1);
+	float *out = (float *)lua_touserdata(L, -1);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (NULL != mod && size_mod > 0)
+			d = clamp_delay(dl, mod[i < size_mod ? i : size_mod - 1]);
+
+		float x = in[i];
+		float y = delay_tap(dl, d);
+		delay_push(dl, x + feedback * y);
+		out[i] = x + mix * (y - x);
+	}
+
+	return 1;
+}
+
+int lhc_delay_new(lua_State *L)
+{
+	lua_Integer maxdelay = luaL_checkinteger(L, 1);
+	if (maxdelay < 1)
+		return luaL_argerror(L, 1, "delay must be positive");
+
+	/* one extra slot for interpolating the oldest sample */
+	size_t size = next_pow2((size_t)maxdelay + 1);
+	DelayLine *dl = (DelayLine *)lua_newuserdata(L,
+			sizeof(DelayLine) + size * sizeof(float));
+	if (NULL == dl)
+		return luaL_error(L, "Cannot create delay line");
+
+	dl->mask = size - 1;
+	dl->pos  = 0;
+	memset(dl->data, 0, size * sizeof(float));
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_delay___len);
+		lua_setfield(L, -2, "__len");
+
+		lua_pushcfunction(L, lhc_delay_push);
+		lua_setfield(L, -2, "push");
+
+		lua_pushcfunction(L, lhc_delay_tap);
+		lua_setfield(L, -2, "tap");
+
+		lua_pushcfunction(L, lhc_delay_clear);
+		lua_setfield(L, -2, "clear");
+
+		lua_pushcfunction(L, lhc_delay_process);
+		lua_setfield(L, -2, "process");
+	}
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/*
+ * feedback delay network reverb
+ */
+#define FDN_LINES     8
+#define FDN_BLOCKSIZE 64
+
+/* mutually prime line lengths in samples at 44.1kHz */
+static const float fdn_lengths[FDN_LINES] = {
+	1031.f, 1327.f, 1523.f, 1801.f, 2029.f, 2311.f, 2539.f, 2803.f
+};
+
+typedef struct {
+	float  *data;
+	size_t  mask;
+	size_t  len;
+	float   gain;
+	float   lp;
+} FDNLine;
+
+/* in-place fast walsh-hadamard transform */
+inline static void fwht(float *v)
+{
+	for (int h = 1; h < FDN_LINES; h <<= 1)
+		for (int i = 0; i < FDN_LINES; i += h << 1)
+			for (int j = i; j < i + h; ++j)
+			{
+				float a = v[j], b = v[j+h];
+				v[j]   = a + b;
+				v[j+h] = a - b;
+			}
+}
+
+inline static int parity(unsigned x)
+{
+	int p = 0;
+	for (; x; x >>= 1)
+		p ^= x & 1;
+	return p;
+}
+
+static lua_Number opt_field(lua_State *L, int idx, const char *name, lua_Number def)
+{
+	if (!lua_istable(L, idx))
+		return def;
+
+	lua_getfield(L, idx, name);
+	lua_Number val = luaL_optnumber(L, -1, def);
+	lua_pop(L, 1);
+	return val;
+}
+
+/* lhc.reverb(buffer [, {size=, decay=, damping=, mix=, tail=, rate=, channels=}]) */
+int lhc_reverb(lua_State *L)
+{
+	float *in       = lhc_checkbuffer(L, 1);
+	size_t size     = lhc_buffer_nsamples(L, 1);
+	float room      = (float)opt_field(L, 2, "size",     .5);
+	float decay     = (float)opt_field(L, 2, "decay",    2.);
+	float damping   = (float)opt_field(L, 2, "damping",  .3);
+	float mix       = (float)opt_field(L, 2, "mix",      .25);
+	double tail     = opt_field(L, 2, "tail",     0.);
+	double rate     = opt_field(L, 2, "rate",     44100.);
+	int channels    = (int)opt_field(L, 2, "channels", 1.);
+
+	if (channels < 1 || size % channels != 0)
+		return luaL_error(L, "Buffer size mismatches number of requested channels");
+	if (decay <= 0.f || rate <= 0.)
+		return luaL_error(L, "Decay time and sample rate must be positive");
+	if (damping < 0.f) damping = 0.f;
+	if (damping > .99f) damping = .99f;
+
+	size_t frames_in  = size / channels;
+	size_t frames_out = frames_in + (size_t)(fmax(tail, 0.) * rate);
+
+	/* set up delay lines */
+	FDNLine lines[FDN_LINES];
+	size_t total = 0;
+	double scale = (.25 + 1.5 * fmin(fmax(room, 0.f), 1.f)) * rate / 44100.;
+	for (int i = 0; i < FDN_LINES; ++i)
+	{
+		size_t len = (size_t)(fdn_lengths[i] * scale);
+		if (len < FDN_BLOCKSIZE)
+			len = FDN_BLOCKSIZE;
+
+		lines[i].len  = len;
+		lines[i].mask = next_pow2(len + 1) - 1;
+		lines[i].gain = (float)pow(10., -3. * (double)len / (decay * rate));
+		lines[i].lp   = 0.f;
+		total += lines[i].mask + 1;
+	}
+
+	float *storage = calloc(total, sizeof(float));
+	if (NULL == storage)
+		return luaL_error(L, "Cannot allocate reverb delay lines");
+	float *p = storage;
+	for (int i = 0; i < FDN_LINES; ++i)
+	{
+		lines[i].data = p;
+		p += lines[i].mask + 1;
+	}
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, frames_out * channels);
+	lua_call(L, 1, 1);
+	float *out = (float *)lua_touserdata(L, -1);
+
+	const float norm = 1.f / sqrtf((float)FDN_LINES);
+	float block_in[FDN_BLOCKSIZE];
+	float taps[FDN_LINES][FDN_BLOCKSIZE];
+	size_t w = 0;
+
+	/* every line is at least one block long, so a whole block of taps can
+	 * be read before any of the block's feedback is written */
+	for (size_t f0 = 0; f0 < frames_out; f0 += FDN_BLOCKSIZE)
+	{
+		size_t nb = frames_out - f0;
+		if (nb > FDN_BLOCKSIZE)
+			nb = FDN_BLOCKSIZE;
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			float x = 0.f;
+			if (f0 + k < frames_in)
+				for (int c = 0; c < channels; ++c)
+					x += in[(f0 + k) * channels + c];
+			block_in[k] = x / (float)channels;
+		}
+
+		for (int i = 0; i < FDN_LINES; ++i)
+		{
+			FDNLine *line = &lines[i];
+			float lp = line->lp;
+			for (size_t k = 0; k < nb; ++k)
+			{
+				float x = line->data[(w + k - line->len) & line->mask];
+				lp += (1.f - damping) * (x - lp);
+				taps[i][k] = lp * line->gain;
+			}
+			line->lp = lp;
+		}
+
+		for (int c = 0; c < channels; ++c)
+		{
+			/* each channel reads the lines through a different hadamard row */
+			float sign[FDN_LINES];
+			for (int i = 0; i < FDN_LINES; ++i)
+				sign[i] = parity((unsigned)(i & (c % FDN_LINES))) ? -norm : norm;
+
+			for (size_t k = 0; k < nb; ++k)
+			{
+				float wet = 0.f;
+				for (int i = 0; i < FDN_LINES; ++i)
+					wet += sign[i] * taps[i][k];
+
+				float dry = f0 + k < frames_in ? in[(f0 + k) * channels + c] : 0.f;
+				out[(f0 + k) * channels + c] = dry + mix * (wet - dry);
+			}
+		}
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			float v[FDN_LINES];
+			for (int i = 0; i < FDN_LINES; ++i)
+				v[i] = taps[i][k];
+			fwht(v);
+			for (int i = 0; i < FDN_LINES; ++i)
+				lines[i].data[(w + k) & lines[i].mask] = v[i] * norm + block_in[k];
+		}
+
+		w += nb;
+	}
+
+	free(storage);
+	return 1;
+}
+
+int luaopen_lhc_delay(lua_State *L)
+{
+	lua_pushcfunction(L, lhc_delay_new);
+	return 1;
+}
+
+int luaopen_lhc_reverb(lua_State *L)
+{
+	lua_pushcfunction(L, lhc_reverb);
+	return 1;
+}
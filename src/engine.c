@@ -0,0 +1,537 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <portaudio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "engine.h"
+#include "osfunc.h"
+#include "player.h"
+
+#define QUARTER_PI 0.7853981633974483
+
+#define ENGINE_SAMPLERATE 44100. /* unless configured otherwise */
+#define ENGINE_MAXVOICES  64
+#define ENGINE_QUEUESIZE  256
+#define ENGINE_BLOCKSIZE  256
+
+static const char *INTERNAL_NAME = "lhc.player.engine";
+static const char *INSTANCE_NAME = "lhc.player.engine-instance";
+
+enum { ENGINE_TRIGGER, ENGINE_HALT };
+
+typedef struct
+{
+	const float  *data;
+	size_t        nframes;
+	int           channels;
+	int           is_looping;
+	double        pos;
+	double        step;
+	float         gl, gr;
+	unsigned int  id;
+} EngineVoice;
+
+typedef struct
+{
+	int         type;
+	EngineVoice voice; /* ENGINE_HALT only uses the id, 0 meaning all */
+} EngineCommand;
+
+typedef struct
+{
+	PaStream *stream;
+
+	/* Lua -> callback */
+	EngineCommand commands[ENGINE_QUEUESIZE];
+	unsigned int  cmd_read;
+	unsigned int  cmd_write;
+
+	/* callback -> Lua: ids of ended voices, whose buffers can be released */
+	unsigned int finished[ENGINE_QUEUESIZE];
+	unsigned int fin_read;
+	unsigned int fin_write;
+
+	/* owned by the callback */
+	EngineVoice voices[ENGINE_MAXVOICES];
+	int         nvoices;
+	float       mix[2][ENGINE_BLOCKSIZE];
+
+	/* owned by Lua */
+	unsigned int next_id;
+	int          outstanding;
+
+	PlayerStats stats;
+} Engine;
+
+/* used whenever the engine stream is opened */
+static PlayerOptions engine_options = {
+	paNoDevice, paFramesPerBufferUnspecified, PLAYER_LATENCY_HIGH, 0
+};
+static double engine_samplerate = ENGINE_SAMPLERATE;
+
+/* cannot overflow: Lua never has more than ENGINE_MAXVOICES outstanding */
+static void engine_finish(Engine *e, unsigned int id)
+{
+	unsigned int write = e->fin_write;
+	e->finished[write % ENGINE_QUEUESIZE] = id;
+	atomic_set(&e->fin_write, write + 1);
+}
+
+static void engine_remove_voice(Engine *e, int i)
+{
+	engine_finish(e, e->voices[i].id);
+	e->voices[i] = e->voices[--e->nvoices];
+}
+
+static void engine_commands(Engine *e)
+{
+	unsigned int read = e->cmd_read, write = atomic_get(&e->cmd_write);
+	for (; read != write; ++read)
+	{
+		EngineCommand *cmd = &e->commands[read % ENGINE_QUEUESIZE];
+		if (ENGINE_TRIGGER == cmd->type)
+		{
+			if (e->nvoices < ENGINE_MAXVOICES)
+				e->voices[e->nvoices++] = cmd->voice;
+			else
+				engine_finish(e, cmd->voice.id);
+			continue;
+		}
+
+		int i;
+		for (i = e->nvoices - 1; i >= 0; --i)
+			if (0 == cmd->voice.id || cmd->voice.id == e->voices[i].id)
+				engine_remove_voice(e, i);
+	}
+	atomic_set(&e->cmd_read, read);
+}
+
+/* adds n frames of the voice to the mix. Returns 0 if the voice ended. */
+/* frame pos + d, wrapping around looped buffers and clamped otherwise */
+static const float *engine_frame(const EngineVoice *v, size_t pos, int d)
+{
+	size_t k;
+	if (d < 0)
+		k = pos > 0 ? pos - 1 : (v->is_looping ? v->nframes - 1 : 0);
+	else if (pos + (size_t)d < v->nframes)
+		k = pos + (size_t)d;
+	else
+		k = v->is_looping ? (pos + (size_t)d) % v->nframes : v->nframes - 1;
+	return v->data + k * v->channels;
+}
+
+inline static float engine_hermite(float x0, float x1, float x2, float x3, float t)
+{
+	float c1 = .5f * (x2 - x0);
+	float c2 = x0 - 2.5f * x1 + 2.f * x2 - .5f * x3;
+	float c3 = .5f * (x3 - x0) + 1.5f * (x1 - x2);
+	return ((c3 * t + c2) * t + c1) * t + x1;
+}
+
+static int engine_render_voice(EngineVoice *v, float *restrict l, float *restrict r, size_t n)
+{
+	const float gl = v->gl, gr = v->gr;
+	const int channels = v->channels;
+	size_t i = 0;
+
+	while (i < n)
+	{
+		if (v->pos >= (double)v->nframes)
+		{
+			if (!v->is_looping)
+				return i > 0;
+			v->pos -= (double)v->nframes;
+		}
+
+		if (1. == v->step)
+		{
+			size_t pos = (size_t)v->pos;
+			size_t m   = v->nframes - pos;
+			if (m > n - i)
+				m = n - i;
+
+			/* plain loops over restrict pointers, so the compiler can
+			 * vectorize the accumulation */
+			const float *restrict src = v->data + pos * channels;
+			float *restrict dl = l + i;
+			float *restrict dr = r + i;
+			size_t k;
+			if (1 == channels)
+				for (k = 0; k < m; ++k)
+				{
+					dl[k] += gl * src[k];
+					dr[k] += gr * src[k];
+				}
+			else
+				for (k = 0; k < m; ++k)
+				{
+					dl[k] += gl * src[2*k];
+					dr[k] += gr * src[2*k+1];
+				}
+
+			v->pos += (double)m;
+			i      += m;
+			continue;
+		}
+
+		/* buffers at other sample rates are resampled with a cubic
+		 * hermite (catmull-rom) spline through the four nearest frames */
+		for (; i < n && v->pos < (double)v->nframes; ++i, v->pos += v->step)
+		{
+			size_t pos = (size_t)v->pos;
+			float t    = (float)(v->pos - (double)pos);
+
+			const float *x0 = engine_frame(v, pos, -1);
+			const float *x1 = v->data + pos * channels;
+			const float *x2 = engine_frame(v, pos, 1);
+			const float *x3 = engine_frame(v, pos, 2);
+			float sl = engine_hermite(x0[0], x1[0], x2[0], x3[0], t);
+			float sr = 2 == channels ? engine_hermite(x0[1], x1[1], x2[1], x3[1], t) : sl;
+			l[i] += gl * sl;
+			r[i] += gr * sr;
+		}
+	}
+
+	return 1;
+}
+
+static int engine_callback(const void *inputBuffer, void *outputBuffer,
+		unsigned long frames, const PaStreamCallbackTimeInfo *timeinfo,
+		PaStreamCallbackFlags status, void *udata)
+{
+	(void)inputBuffer;
+	(void)timeinfo;
+
+	double start = hres_time();
+	Engine *e    = (Engine *)udata;
+	float *out = (float *)outputBuffer;
+
+	engine_commands(e);
+
+	while (frames > 0)
+	{
+		size_t n = frames < ENGINE_BLOCKSIZE ? frames : ENGINE_BLOCKSIZE;
+		memset(e->mix, 0, sizeof e->mix);
+
+		int i;
+		for (i = 0; i < e->nvoices; )
+		{
+			if (engine_render_voice(&e->voices[i], e->mix[0], e->mix[1], n))
+				++i;
+			else
+				engine_remove_voice(e, i);
+		}
+
+		size_t k;
+		for (k = 0; k < n; ++k)
+		{
+			*out++ = e->mix[0][k];
+			*out++ = e->mix[1][k];
+		}
+		frames -= n;
+	}
+
+	player_stats_record(&e->stats, status, start);
+	return paContinue;
+}
+
+static int lhc_engine___gc(lua_State *L)
+{
+	Engine *e = (Engine *)lua_touserdata(L, 1);
+	if (NULL != e->stream)
+	{
+		PaError err = Pa_CloseStream(e->stream);
+		if (err != paNoError)
+			fprintf(stderr, "Unable to close engine stream: %s\n", Pa_GetErrorText(err));
+	}
+	e->stream = NULL;
+	return 0;
+}
+
+/* pushes the engine if it was started, returns NULL otherwise */
+static Engine *engine_find(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, INSTANCE_NAME);
+	if (lua_isuserdata(L, -1))
+		return (Engine *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return NULL;
+}
+
+/* pushes the engine, opening its stream on first use */
+static Engine *engine_get(lua_State *L)
+{
+	Engine *e = engine_find(L);
+	if (NULL != e)
+		return e;
+
+	e = (Engine *)lua_newuserdata(L, sizeof(Engine));
+	memset(e, 0, sizeof(Engine));
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushcfunction(L, lhc_engine___gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	/* fenv[id] = buffer of a voice that may still be playing */
+	lua_newtable(L);
+	lua_setfenv(L, -2);
+
+	PaError err = player_open_stream(&e->stream, 2, engine_samplerate,
+			&engine_options, engine_callback, e);
+	if (err != paNoError)
+	{
+		e->stream = NULL;
+		luaL_error(L, "Cannot create engine stream: %s", Pa_GetErrorText(err));
+	}
+
+	err = Pa_StartStream(e->stream);
+	if (err != paNoError)
+		luaL_error(L, "Cannot start engine stream: %s", Pa_GetErrorText(err));
+
+	lua_pushvalue(L, -1);
+	lua_setfield(L, LUA_REGISTRYINDEX, INSTANCE_NAME);
+	return e;
+}
+
+/* releases the buffers of voices that ended */
+static void engine_reap(lua_State *L, Engine *e, int idx)
+{
+	lua_getfenv(L, idx);
+	unsigned int read = e->fin_read, write = atomic_get(&e->fin_write);
+	for (; read != write; ++read, --e->outstanding)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, -2, (int)e->finished[read % ENGINE_QUEUESIZE]);
+	}
+	atomic_set(&e->fin_read, read);
+	lua_pop(L, 1);
+}
+
+static void engine_send(lua_State *L, Engine *e, const EngineCommand *cmd)
+{
+	unsigned int write = e->cmd_write;
+	int tries;
+	for (tries = 0; write - atomic_get(&e->cmd_read) >= ENGINE_QUEUESIZE; ++tries)
+	{
+		if (tries > 100)
+			luaL_error(L, "Player engine does not respond");
+		hres_sleep(.001);
+	}
+
+	e->commands[write % ENGINE_QUEUESIZE] = *cmd;
+	atomic_set(&e->cmd_write, write + 1);
+}
+
+static lua_Number opt_field(lua_State *L, int idx, const char *name, lua_Number def)
+{
+	if (!lua_istable(L, idx))
+		return def;
+
+	lua_getfield(L, idx, name);
+	lua_Number val = luaL_optnumber(L, -1, def);
+	lua_pop(L, 1);
+	return val;
+}
+
+int lhc_engine_play(lua_State *L)
+{
+	float *buffer     = lhc_checkbuffer(L, 1);
+	size_t nsamples   = lhc_buffer_nsamples(L, 1);
+	double samplerate = luaL_optnumber(L, 2, 44100);
+	int    channels   = luaL_optint(L, 3, 1);
+
+	if (1 != channels && 2 != channels)
+		return luaL_argerror(L, 3, "only mono and stereo buffers can be played");
+	if (samplerate <= 0.)
+		return luaL_argerror(L, 2, "sample rate must be positive");
+	if (nsamples % channels != 0)
+		return luaL_error(L, "Buffer size mismatches number of requested channels");
+
+	EngineCommand cmd;
+	memset(&cmd, 0, sizeof cmd);
+	cmd.type = ENGINE_TRIGGER;
+
+	EngineVoice *v = &cmd.voice;
+	v->data     = buffer;
+	v->nframes  = nsamples / channels;
+	v->channels = channels;
+	v->step     = samplerate / engine_samplerate;
+
+	if (lua_istable(L, 4))
+	{
+		lua_getfield(L, 4, "loop");
+		v->is_looping = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+	else
+		v->is_looping = lua_toboolean(L, 4);
+	v->is_looping = v->is_looping && v->nframes > 0;
+
+	double gain   = opt_field(L, 4, "gain", 1.);
+	double pan    = opt_field(L, 4, "pan", 0.);
+	double offset = opt_field(L, 4, "offset", 0.);
+	if (pan < -1. || pan > 1.)
+		return luaL_error(L, "Invalid pan: %f (must be in [-1,1])", pan);
+	if (offset < 0. || offset > (double)v->nframes)
+		return luaL_error(L, "Invalid offset: %f (buffer has %d frames)", offset, (int)v->nframes);
+	v->pos = floor(offset);
+
+	/* constant power panning for mono buffers, balance for stereo */
+	if (1 == channels)
+	{
+		v->gl = (float)(gain * cos((pan + 1.) * QUARTER_PI));
+		v->gr = (float)(gain * sin((pan + 1.) * QUARTER_PI));
+	}
+	else
+	{
+		v->gl = (float)(gain * (pan > 0. ? 1. - pan : 1.));
+		v->gr = (float)(gain * (pan < 0. ? 1. + pan : 1.));
+	}
+
+	Engine *e = engine_get(L);
+	int idx   = lua_gettop(L);
+	engine_reap(L, e, idx);
+	if (e->outstanding >= ENGINE_MAXVOICES)
+		return luaL_error(L, "Cannot play more than %d voices at once", ENGINE_MAXVOICES);
+
+	if (0 == ++e->next_id)
+		++e->next_id;
+	v->id = e->next_id;
+
+	/* fenv[id] = buffer */
+	lua_getfenv(L, idx);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, (int)v->id);
+	lua_pop(L, 1);
+
+	++e->outstanding;
+	engine_send(L, e, &cmd);
+
+	lua_pushinteger(L, (lua_Integer)v->id);
+	return 1;
+}
+
+int lhc_engine_halt(lua_State *L)
+{
+	EngineCommand cmd;
+	memset(&cmd, 0, sizeof cmd);
+	cmd.type     = ENGINE_HALT;
+	cmd.voice.id = (unsigned int)luaL_optinteger(L, 1, 0);
+
+	/* nothing to stop if the engine never ran */
+	Engine *e = engine_find(L);
+	if (NULL != e)
+		engine_send(L, e, &cmd);
+	return 0;
+}
+
+int lhc_engine_voices(lua_State *L)
+{
+	Engine *e = engine_find(L);
+	if (NULL == e)
+	{
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	engine_reap(L, e, lua_gettop(L));
+	lua_pushinteger(L, e->outstanding);
+	return 1;
+}
+
+static int lhc_engine_start(lua_State *L)
+{
+	engine_get(L);
+	return 0;
+}
+
+int lhc_engine_configure(lua_State *L)
+{
+	PlayerOptions opts, previous = engine_options;
+	double previous_rate = engine_samplerate;
+	player_checkoptions(L, 1, &opts);
+	double samplerate = opt_field(L, 1, "samplerate", ENGINE_SAMPLERATE);
+	if (samplerate <= 0.)
+		return luaL_error(L, "Invalid sample rate: %f", samplerate);
+
+	/* close the running stream, if it is idle */
+	lua_getfield(L, LUA_REGISTRYINDEX, INSTANCE_NAME);
+	if (lua_isuserdata(L, -1))
+	{
+		Engine *e = (Engine *)lua_touserdata(L, -1);
+		engine_reap(L, e, lua_gettop(L));
+		if (e->outstanding > 0)
+			return luaL_error(L, "Cannot reconfigure the engine while voices are playing");
+
+		lua_pushcfunction(L, lhc_engine___gc);
+		lua_pushvalue(L, -2);
+		lua_call(L, 1, 0);
+
+		lua_pushnil(L);
+		lua_setfield(L, LUA_REGISTRYINDEX, INSTANCE_NAME);
+	}
+	lua_pop(L, 1);
+
+	/* open right away so that errors surface here, not in lhc.play */
+	engine_options    = opts;
+	engine_samplerate = samplerate;
+	lua_pushcfunction(L, lhc_engine_start);
+	if (0 != lua_pcall(L, 0, 0, 0))
+	{
+		engine_options    = previous;
+		engine_samplerate = previous_rate;
+		return lua_error(L);
+	}
+
+	return 0;
+}
+
+int lhc_engine_pushstats(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, INSTANCE_NAME);
+	if (!lua_isuserdata(L, -1))
+		return 1;
+
+	Engine *e = (Engine *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return lhc_player_pushstats(L, &e->stats, e->stream);
+}
@@ -0,0 +1,52 @@
+#pragma once
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lua.h>
+
+/* lhc.play(buffer [, rate [, channels [, looping or {gain=, pan=, offset=, loop=}]]])
+ * -- plays the buffer on the shared engine stream, returns a voice id */
+int lhc_engine_play(lua_State *L);
+/* lhc.player.halt([id]) -- stops one or all voices */
+int lhc_engine_halt(lua_State *L);
+/* lhc.player.voices() -- number of voices playing or about to play */
+int lhc_engine_voices(lua_State *L);
+/* lhc.player.engine([options]) -- (re)opens the engine stream with the
+ * device and latency options of lhc.player and an optional samplerate */
+int lhc_engine_configure(lua_State *L);
+/* pushes the engine's stats, or nil if it was never started */
+int lhc_engine_pushstats(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
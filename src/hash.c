@@ -0,0 +1,130 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "hash.h"
+
+/* xxhash64-style hash: four independent lanes over 32 byte stripes */
+static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t P3 = 0x165667B19E3779F9ULL;
+static const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+inline static uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline static uint64_t read64(const unsigned char *p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof x);
+	return x;
+}
+
+inline static uint32_t read32(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof x);
+	return x;
+}
+
+inline static uint64_t round64(uint64_t acc, uint64_t x)
+{
+	acc += x * P2;
+	acc  = rotl(acc, 31);
+	return acc * P1;
+}
+
+inline static uint64_t merge64(uint64_t acc, uint64_t v)
+{
+	acc ^= round64(0, v);
+	return acc * P1 + P4;
+}
+
+uint64_t lhc_hash64(const void *data, size_t len, uint64_t seed)
+{
+	const unsigned char *p   = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32)
+	{
+		uint64_t v1 = seed + P1 + P2;
+		uint64_t v2 = seed + P2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - P1;
+
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = round64(v1, read64(p));      p += 8;
+			v2 = round64(v2, read64(p));      p += 8;
+			v3 = round64(v3, read64(p));      p += 8;
+			v4 = round64(v4, read64(p));      p += 8;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge64(h, v1);
+		h = merge64(h, v2);
+		h = merge64(h, v3);
+		h = merge64(h, v4);
+	}
+	else
+		h = seed + P5;
+
+	h += (uint64_t)len;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= round64(0, read64(p));
+		h  = rotl(h, 27) * P1 + P4;
+	}
+
+	if (p + 4 <= end)
+	{
+		h ^= (uint64_t)read32(p) * P1;
+		h  = rotl(h, 23) * P2 + P3;
+		p += 4;
+	}
+
+	for (; p < end; ++p)
+	{
+		h ^= (*p) * P5;
+		h  = rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
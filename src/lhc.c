@@ -33,18 +33,19 @@
 
 #include "buffer.h"
 #include "player.h"
+#include "engine.h"
 #include "soundfile.h"
 #include "env.h"
+#include "delay.h"
+#include "osc.h"
+#include "noise.h"
+#include "mix.h"
+#include "timeline.h"
+#include "ugen.h"
+#include "memo.h"
+#include "parallel.h"
 #include "osfunc.h"
 
-static int lhc_play(lua_State *L)
-{
-	lhc_player_new(L);
-	lua_replace(L, 1);
-	lua_settop(L, 1);
-	return lhc_player_play(L);
-}
-
 static int lhc_sleep(lua_State *L)
 {
 	lua_Number sleep_time = luaL_checknumber(L, 1);
@@ -52,9 +53,18 @@ static int lhc_sleep(lua_State *L)
 	return 1;
 }
 
+/* lhc.threads([n]) -- get or set the number of worker threads */
+static int lhc_threads(lua_State *L)
+{
+	if (!lua_isnoneornil(L, 1))
+		parallel_set_threads(luaL_checkint(L, 1));
+	lua_pushinteger(L, parallel_threads());
+	return 1;
+}
+
 int luaopen_lhc(lua_State *L)
 {
-	lua_createtable(L, 0, 4);
+	lua_createtable(L, 0, 16);
 
 	luaopen_lhc_buffer(L);
 	lua_setfield(L, -2, "buffer");
@@ -62,7 +72,7 @@ int luaopen_lhc(lua_State *L)
 	luaopen_lhc_player(L);
 	lua_setfield(L, -2, "player");
 
-	lua_pushcfunction(L, lhc_play);
+	lua_pushcfunction(L, lhc_engine_play);
 	lua_setfield(L, -2, "play");
 
 	lua_pushcfunction(L, lhc_sleep);
@@ -74,5 +84,35 @@ int luaopen_lhc(lua_State *L)
 	luaopen_lhc_env(L);
 	lua_setfield(L, -2, "env");
 
+	luaopen_lhc_delay(L);
+	lua_setfield(L, -2, "delay");
+
+	luaopen_lhc_reverb(L);
+	lua_setfield(L, -2, "reverb");
+
+	luaopen_lhc_additive(L);
+	lua_setfield(L, -2, "additive");
+
+	luaopen_lhc_wavetable(L);
+	lua_setfield(L, -2, "wavetable");
+
+	luaopen_lhc_noise(L);
+	lua_setfield(L, -2, "noise");
+
+	luaopen_lhc_mix(L);
+	lua_setfield(L, -2, "mix");
+
+	luaopen_lhc_timeline(L);
+	lua_setfield(L, -2, "timeline");
+
+	luaopen_lhc_ugen(L);
+	lua_setfield(L, -2, "ugen");
+
+	luaopen_lhc_memo(L);
+	lua_setfield(L, -2, "memo");
+
+	lua_pushcfunction(L, lhc_threads);
+	lua_setfield(L, -2, "threads");
+
 	return 1;
 }
@@ -0,0 +1,341 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "hash.h"
+#include "memo.h"
+#include "osfunc.h"
+
+#define MEMO_MAXDEPTH 16
+#define MEMO_SUFFIX   ".lhc"
+#define MEMO_SEED2    0x9e3779b97f4a7c15ULL
+
+static uint64_t memo_hash_value(lua_State *L, int idx, uint64_t h, int depth);
+
+static int memo_pair_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* the sequence 1..#t in order, then all other key/value pairs. Those are
+ * hashed one by one and sorted, so traversal order does not matter. */
+static uint64_t memo_hash_table(lua_State *L, int idx, uint64_t h, int depth)
+{
+	luaL_checkstack(L, 4, "key parts are nested too deeply");
+	size_t n = lua_objlen(L, idx);
+	uint64_t len = n;
+	h = lhc_hash64(&len, sizeof len, h);
+	for (size_t i = 1; i <= n; ++i)
+	{
+		lua_rawgeti(L, idx, (int)i);
+		h = memo_hash_value(L, lua_gettop(L), h, depth + 1);
+		lua_pop(L, 1);
+	}
+
+	size_t npairs = 0;
+	for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1))
+		++npairs;
+	/* userdata scratch space is collected even if hashing a pair fails */
+	uint64_t *pairs = (uint64_t *)lua_newuserdata(L, npairs * sizeof(uint64_t) + 1);
+	int pairs_idx   = lua_gettop(L);
+
+	size_t k = 0;
+	for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1))
+	{
+		if (lua_type(L, -2) == LUA_TNUMBER)
+		{
+			lua_Number x = lua_tonumber(L, -2);
+			if (x >= 1 && x <= (lua_Number)n && x == (lua_Number)(size_t)x)
+				continue;
+		}
+		uint64_t p = memo_hash_value(L, lua_gettop(L) - 1, h, depth + 1);
+		pairs[k++] = memo_hash_value(L, lua_gettop(L), p, depth + 1);
+	}
+	qsort(pairs, k, sizeof(uint64_t), memo_pair_cmp);
+
+	len = k;
+	h = lhc_hash64(&len, sizeof len, h);
+	h = lhc_hash64(pairs, k * sizeof(uint64_t), h);
+	lua_remove(L, pairs_idx);
+	return h;
+}
+
+/*
+ * Keys are built from a running hash over a type tag and the contents
+ * of every key part, so {1, "1"} and {"1", 1} differ.
+ */
+static uint64_t memo_hash_value(lua_State *L, int idx, uint64_t h, int depth)
+{
+	unsigned char tag = (unsigned char)lua_type(L, idx);
+	h = lhc_hash64(&tag, 1, h);
+
+	switch (lua_type(L, idx))
+	{
+		case LUA_TNIL:
+			return h;
+		case LUA_TBOOLEAN:
+			tag = (unsigned char)lua_toboolean(L, idx);
+			return lhc_hash64(&tag, 1, h);
+		case LUA_TNUMBER:
+		{
+			lua_Number x = lua_tonumber(L, idx);
+			return lhc_hash64(&x, sizeof x, h);
+		}
+		case LUA_TSTRING:
+		{
+			size_t len;
+			const char *str = lua_tolstring(L, idx, &len);
+			uint64_t n = len;
+			h = lhc_hash64(&n, sizeof n, h);
+			return lhc_hash64(str, len, h);
+		}
+		case LUA_TTABLE:
+		{
+			if (depth >= MEMO_MAXDEPTH)
+				luaL_error(L, "Key parts are nested too deeply");
+			return memo_hash_table(L, idx, h, depth);
+		}
+		case LUA_TUSERDATA:
+			if (lua_isbuffer(L, idx))
+			{
+				uint64_t n = lua_objlen(L, idx);
+				h = lhc_hash64(&n, sizeof n, h);
+				return lhc_hash64(lua_touserdata(L, idx), n, h);
+			}
+			/* fall through */
+		default:
+			luaL_error(L, "Cannot use a %s as key part", luaL_typename(L, idx));
+	}
+
+	return h;
+}
+
+typedef struct {
+	const char *dir;
+	size_t      dirlen;
+	size_t      total;
+	size_t      count;
+	size_t      capacity;
+	struct MemoFile {
+		char  *path;
+		double mtime;
+		size_t size;
+	} *files;
+} MemoScan;
+
+static char *memo_path(const char *dir, const char *name)
+{
+	size_t dirlen = strlen(dir), namelen = strlen(name);
+	char *path = malloc(dirlen + namelen + 2);
+	if (NULL != path)
+	{
+		memcpy(path, dir, dirlen);
+		path[dirlen] = '/';
+		memcpy(path + dirlen + 1, name, namelen + 1);
+	}
+	return path;
+}
+
+static void memo_scan_file(const char *name, void *ud)
+{
+	MemoScan *scan = (MemoScan *)ud;
+	size_t len = strlen(name);
+	if (len < sizeof(MEMO_SUFFIX) || 0 != strcmp(name + len - sizeof(MEMO_SUFFIX) + 1, MEMO_SUFFIX))
+		return;
+
+	if (scan->count == scan->capacity)
+	{
+		size_t capacity = scan->capacity > 0 ? 2 * scan->capacity : 64;
+		void *files = realloc(scan->files, capacity * sizeof(struct MemoFile));
+		if (NULL == files)
+			return;
+		scan->files    = files;
+		scan->capacity = capacity;
+	}
+
+	struct MemoFile *f = &scan->files[scan->count];
+	f->path = memo_path(scan->dir, name);
+	if (NULL == f->path || !file_stat(f->path, &f->mtime, &f->size))
+	{
+		free(f->path);
+		return;
+	}
+
+	scan->total += f->size;
+	scan->count++;
+}
+
+static int memo_file_cmp(const void *a, const void *b)
+{
+	double ma = ((const struct MemoFile *)a)->mtime;
+	double mb = ((const struct MemoFile *)b)->mtime;
+	return ma < mb ? -1 : (ma > mb ? 1 : 0);
+}
+
+/* remove least recently used entries until the cache fits into limit bytes */
+static void memo_evict(const char *dir, size_t limit)
+{
+	MemoScan scan;
+	memset(&scan, 0, sizeof scan);
+	scan.dir = dir;
+	if (!dir_list(dir, memo_scan_file, &scan))
+		return;
+
+	qsort(scan.files, scan.count, sizeof(struct MemoFile), memo_file_cmp);
+	for (size_t i = 0; i < scan.count; ++i)
+	{
+		if (scan.total > limit && 0 == remove(scan.files[i].path))
+			scan.total -= scan.files[i].size;
+		free(scan.files[i].path);
+	}
+	free(scan.files);
+}
+
+/* lhc.memo(key_parts, fn [, ...]) -- the buffer returned by fn(...), from
+ * the on-disk cache if the key parts were seen before. fn may also return
+ * sample rate and channels; they are stored along with the buffer. */
+static int lhc_memo___call(lua_State *L)
+{
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	int nargs = lua_gettop(L) - 3;
+
+	lua_getfield(L, 1, "dir");
+	lua_getfield(L, 1, "limit");
+	const char *dir  = luaL_optstring(L, -2, ".lhc-memo");
+	lua_Number limit = luaL_optnumber(L, -1, 1024. * 1024. * 1024.);
+	lua_pop(L, 2);
+	lua_pushstring(L, dir);
+	int dir_idx = lua_gettop(L);
+	dir = lua_tostring(L, dir_idx);
+
+	/* the file is named after the first half of a 128 bit digest of the
+	 * key; the full digest is stored in the file and checked on a hit */
+	uint64_t digest[2];
+	digest[0] = memo_hash_value(L, 2, 0, 0);
+	digest[1] = memo_hash_value(L, 2, MEMO_SEED2, 0);
+	char name[32];
+	snprintf(name, sizeof name, "%016llx" MEMO_SUFFIX, (unsigned long long)digest[0]);
+
+	if (!dir_create(dir))
+		return luaL_error(L, "Cannot create cache directory `%s'", dir);
+
+	lua_pushfstring(L, "%s/%s", dir, name);
+	int path_idx = lua_gettop(L);
+	const char *path = lua_tostring(L, path_idx);
+
+	if (file_stat(path, NULL, NULL))
+	{
+		lua_pushcfunction(L, lhc_buffer_load);
+		lua_pushvalue(L, path_idx);
+		if (0 == lua_pcall(L, 1, 4, 0))
+		{
+			size_t taglen;
+			const char *tag = lua_tolstring(L, -1, &taglen);
+			if (taglen >= sizeof digest && 0 == memcmp(tag, digest, sizeof digest))
+			{
+				file_touch(path);
+				lua_pop(L, 1);
+				return 3;
+			}
+			/* different key with the same file name: replaced below */
+			lua_pop(L, 4);
+		}
+		else /* damaged or still being replaced: recompute */
+			lua_pop(L, 1);
+	}
+
+	lua_pushvalue(L, 3);
+	for (int i = 0; i < nargs; ++i)
+		lua_pushvalue(L, 4 + i);
+	lua_call(L, nargs, 3);
+	lhc_checkbuffer(L, -3);
+	int result = lua_gettop(L) - 2;
+
+	lua_Integer rate     = luaL_optinteger(L, result + 1, 44100);
+	lua_Integer channels = luaL_optinteger(L, result + 2, 1);
+
+	/* write next to the entry and move it into place, so that other
+	 * processes never see a partially written file */
+	static unsigned long counter;
+	lua_pushfstring(L, "%s.%d-%d.tmp", path, (int)process_id(), (int)atomic_add(&counter, 1));
+	const char *tmp = lua_tostring(L, -1);
+
+	lua_pushcfunction(L, lhc_buffer_save);
+	lua_pushvalue(L, result);
+	lua_pushvalue(L, -3);
+	lua_pushinteger(L, rate);
+	lua_pushinteger(L, channels);
+	lua_pushlstring(L, (const char *)digest, sizeof digest);
+	if (0 != lua_pcall(L, 5, 0, 0))
+	{
+		remove(tmp);
+		return lua_error(L);
+	}
+	if (!file_replace(tmp, path))
+	{
+		remove(tmp);
+		return luaL_error(L, "Cannot move cache entry into place: `%s'", path);
+	}
+	lua_pop(L, 1);
+
+	memo_evict(dir, limit > 0 ? (size_t)limit : 0);
+
+	lua_pushvalue(L, result);
+	lua_pushinteger(L, rate);
+	lua_pushinteger(L, channels);
+	return 3;
+}
+
+int luaopen_lhc_memo(lua_State *L)
+{
+	lua_createtable(L, 0, 2);
+
+	lua_pushstring(L, ".lhc-memo");
+	lua_setfield(L, -2, "dir");
+
+	lua_pushnumber(L, 1024. * 1024. * 1024.);
+	lua_setfield(L, -2, "limit");
+
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lhc_memo___call);
+	lua_setfield(L, -2, "__call");
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
@@ -0,0 +1,152 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "mix.h"
+#include "parallel.h"
+
+/* blocks are small enough to stay in cache while all sources are added */
+#define MIX_BLOCKSIZE 4096
+#define MIX_GRAIN     16
+
+void mix_accumulate(float *out, const float *in, size_t n, float gain)
+{
+	if (1.0f == gain)
+		for (size_t i = 0; i < n; ++i)
+			out[i] += in[i];
+	else
+		for (size_t i = 0; i < n; ++i)
+			out[i] += gain * in[i];
+}
+
+void mix_sources(float *out, size_t pos, size_t n, const MixSource *src, size_t nsrc)
+{
+	ptrdiff_t b0 = (ptrdiff_t)pos, b1 = (ptrdiff_t)(pos + n);
+	for (size_t s = 0; s < nsrc; ++s)
+	{
+		ptrdiff_t s0 = src[s].offset;
+		ptrdiff_t s1 = s0 + (ptrdiff_t)src[s].len;
+		ptrdiff_t i0 = s0 > b0 ? s0 : b0;
+		ptrdiff_t i1 = s1 < b1 ? s1 : b1;
+		if (i0 >= i1)
+			continue;
+
+		mix_accumulate(out + (i0 - b0), src[s].data + (i0 - s0),
+				(size_t)(i1 - i0), src[s].gain);
+	}
+}
+
+typedef struct {
+	float           *out;
+	size_t           n;
+	const MixSource *src;
+	size_t           nsrc;
+} MixJob;
+
+static void mix_blocks(void *ud, size_t begin, size_t end)
+{
+	MixJob *job = (MixJob *)ud;
+	for (size_t block = begin; block < end; ++block)
+	{
+		size_t pos = block * MIX_BLOCKSIZE;
+		size_t n   = pos + MIX_BLOCKSIZE < job->n ? MIX_BLOCKSIZE : job->n - pos;
+		memset(job->out + pos, 0, n * sizeof(float));
+		mix_sources(job->out + pos, pos, n, job->src, job->nsrc);
+	}
+}
+
+/* lhc.mix({buffer [, gain [, offset]]} or buffer, ...) */
+int lhc_mix(lua_State *L)
+{
+	int nsrc = lua_gettop(L);
+	MixSource *src = (MixSource *)lua_newuserdata(L, (nsrc > 0 ? nsrc : 1) * sizeof(MixSource));
+
+	size_t size = 0;
+	for (int i = 1; i <= nsrc; ++i)
+	{
+		MixSource *s = &src[i-1];
+		s->gain   = 1.0f;
+		s->offset = 0;
+
+		if (lua_istable(L, i))
+		{
+			lua_rawgeti(L, i, 1);
+			if (!lua_isbuffer(L, -1))
+				return luaL_typerror(L, i, "{buffer, gain, offset}");
+			s->data = (const float *)lua_touserdata(L, -1);
+			s->len  = lhc_buffer_nsamples(L, -1);
+			lua_pop(L, 1);
+
+			lua_rawgeti(L, i, 2);
+			s->gain = (float)luaL_optnumber(L, -1, 1.);
+			lua_rawgeti(L, i, 3);
+			s->offset = (ptrdiff_t)luaL_optinteger(L, -1, 0);
+			lua_pop(L, 2);
+		}
+		else if (lua_isbuffer(L, i))
+		{
+			s->data = (const float *)lua_touserdata(L, i);
+			s->len  = lhc_buffer_nsamples(L, i);
+		}
+		else
+			return luaL_typerror(L, i, "buffer or {buffer, gain, offset}");
+
+		ptrdiff_t end = s->offset + (ptrdiff_t)s->len;
+		if (end > 0 && (size_t)end > size)
+			size = (size_t)end;
+	}
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, size);
+	lua_call(L, 1, 1);
+
+	MixJob job;
+	job.out  = (float *)lua_touserdata(L, -1);
+	job.n    = size;
+	job.src  = src;
+	job.nsrc = (size_t)nsrc;
+
+	size_t nblocks = (size + MIX_BLOCKSIZE - 1) / MIX_BLOCKSIZE;
+	parallel_for(nblocks, MIX_GRAIN, mix_blocks, &job);
+
+	return 1;
+}
+
+int luaopen_lhc_mix(lua_State *L)
+{
+	lua_pushcfunction(L, lhc_mix);
+	return 1;
+}
@@ -0,0 +1,296 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "noise.h"
+#include "osfunc.h"
+#include "parallel.h"
+
+#define TWO_PI 6.283185307179586
+
+static const char *RNG_NAME = "lhc.noise.rng";
+
+/* every chunk has its own generator, so the output only depends on seed,
+ * stream and chunk size, but not on the number of threads */
+#define NOISE_CHUNKSIZE 16384
+
+static uint64_t splitmix64(uint64_t *z)
+{
+	uint64_t x = (*z += 0x9E3779B97F4A7C15ULL);
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+void lhc_rng_seed(lhc_rng *rng, uint64_t seed, uint64_t stream)
+{
+	uint64_t z = seed ^ splitmix64(&stream);
+	rng->s[0] = splitmix64(&z);
+	rng->s[1] = splitmix64(&z);
+}
+
+inline static void gaussian_pair(lhc_rng *rng, float *z0, float *z1)
+{
+	/* box-muller; u1 in (0, 1] */
+	double u1 = 1. - (double)(lhc_rng_next(rng) >> 11) * (1. / 9007199254740992.);
+	double u2 = (double)(lhc_rng_next(rng) >> 11) * (1. / 9007199254740992.);
+	double r  = sqrt(-2. * log(u1));
+	*z0 = (float)(r * cos(TWO_PI * u2));
+	*z1 = (float)(r * sin(TWO_PI * u2));
+}
+
+enum { NOISE_UNIFORM, NOISE_GAUSSIAN };
+
+typedef struct {
+	float    *out;
+	size_t    n;
+	uint64_t  seed;
+	uint64_t  stream;
+	int       kind;
+	float     a, b;
+} NoiseFill;
+
+static void noise_fill_chunks(void *ud, size_t begin, size_t end)
+{
+	NoiseFill *job = (NoiseFill *)ud;
+	for (size_t chunk = begin; chunk < end; ++chunk)
+	{
+		lhc_rng rng;
+		lhc_rng_seed(&rng, job->seed, job->stream);
+		lhc_rng_seed(&rng, lhc_rng_next(&rng), chunk);
+
+		size_t i0 = chunk * NOISE_CHUNKSIZE;
+		size_t i1 = i0 + NOISE_CHUNKSIZE < job->n ? i0 + NOISE_CHUNKSIZE : job->n;
+		float *out = job->out;
+
+		if (NOISE_UNIFORM == job->kind)
+		{
+			/* a + (b-a)*u can round up to b in float; stay in [a, b) */
+			double scale = (double)job->b - job->a;
+			float top    = job->b > job->a ? nextafterf(job->b, job->a) : job->a;
+			for (size_t i = i0; i < i1; ++i)
+			{
+				float x = (float)(job->a + scale * lhc_rng_float(&rng));
+				out[i]  = x < top ? x : top;
+			}
+		}
+		else
+		{
+			float z0, z1;
+			size_t i = i0;
+			for (; i + 1 < i1; i += 2)
+			{
+				gaussian_pair(&rng, &z0, &z1);
+				out[i]   = job->a + job->b * z0;
+				out[i+1] = job->a + job->b * z1;
+			}
+			if (i < i1)
+			{
+				gaussian_pair(&rng, &z0, &z1);
+				out[i] = job->a + job->b * z0;
+			}
+		}
+	}
+}
+
+static uint64_t opt_seed(lua_State *L, int idx)
+{
+	static uint64_t counter = 0;
+	if (lua_isnoneornil(L, idx))
+	{
+		uint64_t z = (uint64_t)(hres_time() * 1e9) + atomic_add(&counter, 1);
+		return splitmix64(&z);
+	}
+	return (uint64_t)luaL_checkinteger(L, idx);
+}
+
+/* new buffer of n samples filled with noise; returns the buffer's samples */
+static float *noise_fill(lua_State *L, int kind, float a, float b, int idx_seed)
+{
+	lua_Integer n = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, n >= 0, 1, "size must not be negative");
+
+	NoiseFill job;
+	job.n      = (size_t)n;
+	job.seed   = opt_seed(L, idx_seed);
+	job.stream = (uint64_t)luaL_optinteger(L, idx_seed + 1, 0);
+	job.kind   = kind;
+	job.a      = a;
+	job.b      = b;
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, n);
+	lua_call(L, 1, 1);
+	job.out = (float *)lua_touserdata(L, -1);
+
+	size_t nchunks = (job.n + NOISE_CHUNKSIZE - 1) / NOISE_CHUNKSIZE;
+	parallel_for(nchunks, 1, noise_fill_chunks, &job);
+	return job.out;
+}
+
+/* lhc.noise.white(n [, seed [, stream]]) */
+static int lhc_noise_white(lua_State *L)
+{
+	noise_fill(L, NOISE_UNIFORM, -1.f, 1.f, 2);
+	return 1;
+}
+
+/* lhc.noise.uniform(n [, lo, hi [, seed [, stream]]]) */
+static int lhc_noise_uniform(lua_State *L)
+{
+	float lo = (float)luaL_optnumber(L, 2, 0.);
+	float hi = (float)luaL_optnumber(L, 3, 1.);
+	noise_fill(L, NOISE_UNIFORM, lo, hi, 4);
+	return 1;
+}
+
+/* lhc.noise.gaussian(n [, mean, stddev [, seed [, stream]]]) */
+static int lhc_noise_gaussian(lua_State *L)
+{
+	float mean = (float)luaL_optnumber(L, 2, 0.);
+	float sd   = (float)luaL_optnumber(L, 3, 1.);
+	noise_fill(L, NOISE_GAUSSIAN, mean, sd, 4);
+	return 1;
+}
+
+/* lhc.noise.pink(n [, seed [, stream]])
+ * white noise through paul kellett's pinking filter */
+static int lhc_noise_pink(lua_State *L)
+{
+	float *buf = noise_fill(L, NOISE_UNIFORM, -1.f, 1.f, 2);
+	size_t n   = lhc_buffer_nsamples(L, -1);
+
+	float b0 = 0, b1 = 0, b2 = 0, b3 = 0, b4 = 0, b5 = 0, b6 = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		float w = buf[i];
+		b0 = 0.99886f * b0 + w * 0.0555179f;
+		b1 = 0.99332f * b1 + w * 0.0750759f;
+		b2 = 0.96900f * b2 + w * 0.1538520f;
+		b3 = 0.86650f * b3 + w * 0.3104856f;
+		b4 = 0.55000f * b4 + w * 0.5329522f;
+		b5 = -0.7616f * b5 - w * 0.0168980f;
+		buf[i] = (b0 + b1 + b2 + b3 + b4 + b5 + b6 + w * 0.5362f) * 0.11f;
+		b6 = w * 0.115926f;
+	}
+	return 1;
+}
+
+/* lhc.noise.brown(n [, seed [, stream]]) */
+static int lhc_noise_brown(lua_State *L)
+{
+	float *buf = noise_fill(L, NOISE_UNIFORM, -1.f, 1.f, 2);
+	size_t n   = lhc_buffer_nsamples(L, -1);
+
+	float b = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		b = (b + 0.02f * buf[i]) / 1.02f;
+		buf[i] = b * 3.5f;
+	}
+	return 1;
+}
+
+static lhc_rng *lhc_checkrng(lua_State *L, int idx)
+{
+	return (lhc_rng *)luaL_checkudata(L, idx, RNG_NAME);
+}
+
+/* rng:uniform([lo, hi]) */
+static int lhc_noise_rng_uniform(lua_State *L)
+{
+	lhc_rng *rng = lhc_checkrng(L, 1);
+	lua_Number lo = luaL_optnumber(L, 2, 0.);
+	lua_Number hi = luaL_optnumber(L, 3, 1.);
+	lua_Number u  = (lua_Number)(lhc_rng_next(rng) >> 11) * (1. / 9007199254740992.);
+	lua_Number x  = lo + (hi - lo) * u;
+	if (hi > lo && x >= hi)
+		x = nextafter(hi, lo);
+	lua_pushnumber(L, x);
+	return 1;
+}
+
+/* rng:gaussian([mean, stddev]) */
+static int lhc_noise_rng_gaussian(lua_State *L)
+{
+	lhc_rng *rng = lhc_checkrng(L, 1);
+	lua_Number mean = luaL_optnumber(L, 2, 0.);
+	lua_Number sd   = luaL_optnumber(L, 3, 1.);
+	float z0, z1;
+	gaussian_pair(rng, &z0, &z1);
+	lua_pushnumber(L, mean + sd * z0);
+	return 1;
+}
+
+/* lhc.noise.rng([seed [, stream]]) */
+static int lhc_noise_rng(lua_State *L)
+{
+	uint64_t seed   = opt_seed(L, 1);
+	uint64_t stream = (uint64_t)luaL_optinteger(L, 2, 0);
+
+	lhc_rng *rng = (lhc_rng *)lua_newuserdata(L, sizeof(lhc_rng));
+	lhc_rng_seed(rng, seed, stream);
+
+	if (luaL_newmetatable(L, RNG_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_noise_rng_uniform);
+		lua_setfield(L, -2, "uniform");
+
+		lua_pushcfunction(L, lhc_noise_rng_gaussian);
+		lua_setfield(L, -2, "gaussian");
+	}
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+#define lhc_register_function(L, func, name) \
+	lua_pushcfunction(L, func); \
+	lua_setfield(L, -2, name)
+int luaopen_lhc_noise(lua_State *L)
+{
+	lua_createtable(L, 0, 6);
+	lhc_register_function(L, lhc_noise_white,    "white");
+	lhc_register_function(L, lhc_noise_pink,     "pink");
+	lhc_register_function(L, lhc_noise_brown,    "brown");
+	lhc_register_function(L, lhc_noise_uniform,  "uniform");
+	lhc_register_function(L, lhc_noise_gaussian, "gaussian");
+	lhc_register_function(L, lhc_noise_rng,      "rng");
+	return 1;
+}
@@ -0,0 +1,65 @@
+#pragma once
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lua.h>
+#include <stdint.h>
+
+/* xoroshiro128+ */
+typedef struct {
+	uint64_t s[2];
+} lhc_rng;
+
+void lhc_rng_seed(lhc_rng *rng, uint64_t seed, uint64_t stream);
+
+static inline uint64_t lhc_rng_next(lhc_rng *rng)
+{
+	uint64_t s0 = rng->s[0], s1 = rng->s[1];
+	uint64_t result = s0 + s1;
+	s1 ^= s0;
+	rng->s[0] = ((s0 << 24) | (s0 >> 40)) ^ s1 ^ (s1 << 16);
+	rng->s[1] = (s1 << 37) | (s1 >> 27);
+	return result;
+}
+
+/* uniform in [0, 1) */
+static inline float lhc_rng_float(lhc_rng *rng)
+{
+	return (float)(lhc_rng_next(rng) >> 40) * (1.0f / 16777216.0f);
+}
+
+int luaopen_lhc_noise(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,646 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "hash.h"
+#include "osc.h"
+
+#define TWO_PI 6.283185307179586
+
+static const char *WAVETABLE_NAME  = "lhc.wavetable";
+static const char *WAVETABLE_CACHE = "lhc.wavetable.cache";
+static const char *WAVETABLE_LRU   = "lhc.wavetable.lru";
+
+#define WAVETABLE_BUDGET (64 * 1024 * 1024) /* bytes */
+
+/* number of elements in a table or buffer argument */
+static size_t lhc_osc_len(lua_State *L, int idx, const char *what)
+{
+	if (lua_isbuffer(L, idx))
+		return lhc_buffer_nsamples(L, idx);
+	if (lua_istable(L, idx))
+		return lua_objlen(L, idx);
+	return luaL_typerror(L, idx, what);
+}
+
+/* i-th (zero based) number in a table or buffer argument */
+static double lhc_osc_at(lua_State *L, int idx, size_t i)
+{
+	if (lua_isbuffer(L, idx))
+		return ((float *)lua_touserdata(L, idx))[i];
+
+	lua_rawgeti(L, idx, (int)i + 1);
+	double x = lua_tonumber(L, -1);
+	lua_pop(L, 1);
+	return x;
+}
+
+/*
+ * additive synthesis
+ *
+ * Partials are grouped into ADDITIVE_LANES wide bundles of recursive
+ * (rotating phasor) oscillators. Each bundle accumulates into a per-lane
+ * block, so the inner loop is free of reductions and vectorizes.
+ */
+#define ADDITIVE_LANES     8
+#define ADDITIVE_BLOCKSIZE 256
+
+typedef struct {
+	double       c[ADDITIVE_LANES],  s[ADDITIVE_LANES];
+	double       cw[ADDITIVE_LANES], sw[ADDITIVE_LANES];
+	float        amp[ADDITIVE_LANES];
+	const float *env[ADDITIVE_LANES];
+	size_t       env_len[ADDITIVE_LANES];
+} PartialBundle;
+
+static void additive_render_bundle(PartialBundle *pb, size_t pos, size_t nb,
+		double acc[][ADDITIVE_LANES])
+{
+	double c[ADDITIVE_LANES], s[ADDITIVE_LANES];
+	double cw[ADDITIVE_LANES], sw[ADDITIVE_LANES];
+	memcpy(c,  pb->c,  sizeof c);
+	memcpy(s,  pb->s,  sizeof s);
+	memcpy(cw, pb->cw, sizeof cw);
+	memcpy(sw, pb->sw, sizeof sw);
+
+	int has_env = 0;
+	for (int l = 0; l < ADDITIVE_LANES; ++l)
+		has_env |= NULL != pb->env[l];
+
+	if (!has_env)
+	{
+		double amp[ADDITIVE_LANES];
+		for (int l = 0; l < ADDITIVE_LANES; ++l)
+			amp[l] = pb->amp[l];
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			for (int l = 0; l < ADDITIVE_LANES; ++l)
+			{
+				acc[k][l] += s[l] * amp[l];
+				double cn = c[l] * cw[l] - s[l] * sw[l];
+				s[l]      = c[l] * sw[l] + s[l] * cw[l];
+				c[l]      = cn;
+			}
+		}
+	}
+	else
+	{
+		float amp[ADDITIVE_BLOCKSIZE][ADDITIVE_LANES];
+		for (int l = 0; l < ADDITIVE_LANES; ++l)
+		{
+			const float *env = pb->env[l];
+			size_t len       = pb->env_len[l];
+			for (size_t k = 0; k < nb; ++k)
+			{
+				if (NULL == env)
+					amp[k][l] = pb->amp[l];
+				else /* envelopes hold their last value */
+					amp[k][l] = env[pos + k < len ? pos + k : len - 1];
+			}
+		}
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			for (int l = 0; l < ADDITIVE_LANES; ++l)
+			{
+				acc[k][l] += s[l] * amp[k][l];
+				double cn = c[l] * cw[l] - s[l] * sw[l];
+				s[l]      = c[l] * sw[l] + s[l] * cw[l];
+				c[l]      = cn;
+			}
+		}
+	}
+
+	/* pull the phasors back onto the unit circle */
+	for (int l = 0; l < ADDITIVE_LANES; ++l)
+	{
+		double g = 1.5 - .5 * (c[l] * c[l] + s[l] * s[l]);
+		pb->c[l] = c[l] * g;
+		pb->s[l] = s[l] * g;
+	}
+}
+
+/* lhc.additive(n, freqs, amps [, phases, rate]) */
+int lhc_additive(lua_State *L)
+{
+	lua_Integer n = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, n >= 0, 1, "size must not be negative");
+	size_t npartials = lhc_osc_len(L, 2, "table or buffer");
+	size_t namps     = lhc_osc_len(L, 3, "table or buffer");
+	int has_phases   = !lua_isnoneornil(L, 4);
+	double rate      = luaL_optnumber(L, 5, 44100.);
+
+	if (namps < npartials)
+		return luaL_argerror(L, 3, "need one amplitude per partial");
+	if (has_phases && lhc_osc_len(L, 4, "table or buffer or nil") < npartials)
+		return luaL_argerror(L, 4, "need one phase per partial");
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, n);
+	lua_pushnumber(L, 0);
+	lua_call(L, 2, 1);
+	float *out = (float *)lua_touserdata(L, -1);
+
+	size_t nbundles = (npartials + ADDITIVE_LANES - 1) / ADDITIVE_LANES;
+	PartialBundle *bundles = calloc(nbundles > 0 ? nbundles : 1, sizeof(PartialBundle));
+	if (NULL == bundles)
+		return luaL_error(L, "Cannot allocate partials");
+
+	/* pack audible partials into bundles; unused lanes stay silent */
+	size_t used = 0;
+	for (size_t i = 0; i < npartials; ++i)
+	{
+		double f = lhc_osc_at(L, 2, i);
+		if (f <= 0. || f >= rate * .5)
+			continue;
+
+		PartialBundle *pb = &bundles[used / ADDITIVE_LANES];
+		int l = (int)(used % ADDITIVE_LANES);
+		++used;
+
+		double w     = TWO_PI * f / rate;
+		double phase = has_phases ? lhc_osc_at(L, 4, i) : 0.;
+		pb->c[l]  = cos(phase);
+		pb->s[l]  = sin(phase);
+		pb->cw[l] = cos(w);
+		pb->sw[l] = sin(w);
+
+		if (lua_istable(L, 3))
+		{
+			lua_rawgeti(L, 3, (int)i + 1);
+			if (lua_isbuffer(L, -1) && lhc_buffer_nsamples(L, -1) > 0)
+			{
+				/* referenced by the amps table, so it stays alive */
+				pb->env[l]     = (const float *)lua_touserdata(L, -1);
+				pb->env_len[l] = lhc_buffer_nsamples(L, -1);
+			}
+			else
+				pb->amp[l] = (float)lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		else
+			pb->amp[l] = (float)lhc_osc_at(L, 3, i);
+	}
+	nbundles = (used + ADDITIVE_LANES - 1) / ADDITIVE_LANES;
+
+	double acc[ADDITIVE_BLOCKSIZE][ADDITIVE_LANES];
+	for (size_t pos = 0; pos < (size_t)n; pos += ADDITIVE_BLOCKSIZE)
+	{
+		size_t nb = (size_t)n - pos;
+		if (nb > ADDITIVE_BLOCKSIZE)
+			nb = ADDITIVE_BLOCKSIZE;
+
+		memset(acc, 0, sizeof acc);
+		for (size_t b = 0; b < nbundles; ++b)
+			additive_render_bundle(&bundles[b], pos, nb, acc);
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			double x = 0.;
+			for (int l = 0; l < ADDITIVE_LANES; ++l)
+				x += acc[k][l];
+			out[pos + k] = (float)x;
+		}
+	}
+
+	free(bundles);
+	return 1;
+}
+
+int luaopen_lhc_additive(lua_State *L)
+{
+	lua_pushcfunction(L, lhc_additive);
+	return 1;
+}
+
+/*
+ * band-limited wavetables
+ *
+ * The table is resampled to a power of two size and stored as a stack of
+ * mip-map levels; level k keeps only the lower (size/2) >> k harmonics.
+ * Each level carries one guard sample so interpolation never wraps.
+ */
+#define WAVETABLE_MINSIZE   64
+#define WAVETABLE_MAXSIZE   65536
+#define WAVETABLE_BLOCKSIZE 64
+
+typedef struct Wavetable {
+	struct Wavetable *prev, *next; /* cache recency, most recent first */
+	size_t bytes;
+	char   key[40];
+	size_t size;
+	int    nlevels;
+	float  data[];
+} Wavetable;
+
+/* the cache table holds the wavetables; this list tracks which to drop */
+typedef struct {
+	Wavetable *head, *tail;
+	size_t     used, budget, entries;
+} WavetableLRU;
+
+/* modulation buffers hold their last value */
+inline static float buffer_at(const float *buf, size_t len, size_t i)
+{
+	return i < len ? buf[i] : buf[len - 1];
+}
+
+inline static const float *wavetable_level(const Wavetable *wt, int k)
+{
+	return wt->data + (size_t)k * (wt->size + 1);
+}
+
+/* in-place iterative radix-2 fft */
+static void fft(double *re, double *im, size_t n, int inverse)
+{
+	for (size_t i = 1, j = 0; i < n; ++i)
+	{
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+
+		if (i < j)
+		{
+			double t;
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (size_t len = 2; len <= n; len <<= 1)
+	{
+		double ang = (inverse ? TWO_PI : -TWO_PI) / (double)len;
+		for (size_t k = 0; k < len / 2; ++k)
+		{
+			double wr = cos(ang * (double)k), wi = sin(ang * (double)k);
+			for (size_t i = k; i < n; i += len)
+			{
+				size_t j  = i + len / 2;
+				double tr = re[j] * wr - im[j] * wi;
+				double ti = re[j] * wi + im[j] * wr;
+				re[j] = re[i] - tr;
+				im[j] = im[i] - ti;
+				re[i] += tr;
+				im[i] += ti;
+			}
+		}
+	}
+
+	if (inverse)
+		for (size_t i = 0; i < n; ++i)
+		{
+			re[i] /= (double)n;
+			im[i] /= (double)n;
+		}
+}
+
+static int wavetable_build(Wavetable *wt, const float *table, size_t len)
+{
+	size_t n = wt->size;
+	double *re   = malloc(4 * n * sizeof(double));
+	if (NULL == re)
+		return 0;
+	double *im   = re + n;
+	double *spec = re + 2 * n;
+
+	/* resample to n points (single period, linear interpolation) */
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x  = (double)i * (double)len / (double)n;
+		size_t j  = (size_t)x;
+		double fr = x - (double)j;
+		re[i] = table[j] + fr * (table[(j + 1) % len] - table[j]);
+		im[i] = 0.;
+	}
+
+	fft(re, im, n, 0);
+	memcpy(spec, re, 2 * n * sizeof(double));
+
+	for (int k = 0; k < wt->nlevels; ++k)
+	{
+		size_t harmonics = (n / 2) >> k;
+		memcpy(re, spec, 2 * n * sizeof(double));
+		for (size_t h = harmonics + 1; h + harmonics < n; ++h)
+			re[h] = im[h] = 0.;
+		/* the nyquist bin is ambiguous, drop it on every level */
+		re[n / 2] = im[n / 2] = 0.;
+		fft(re, im, n, 1);
+
+		float *level = wt->data + (size_t)k * (n + 1);
+		for (size_t i = 0; i < n; ++i)
+			level[i] = (float)re[i];
+		level[n] = level[0];
+	}
+
+	free(re);
+	return 1;
+}
+
+static Wavetable *lhc_checkwavetable(lua_State *L, int idx)
+{
+	return (Wavetable *)luaL_checkudata(L, idx, WAVETABLE_NAME);
+}
+
+static int lhc_wavetable___len(lua_State *L)
+{
+	Wavetable *wt = lhc_checkwavetable(L, 1);
+	lua_pushinteger(L, wt->size);
+	return 1;
+}
+
+static int lhc_wavetable_levels(lua_State *L)
+{
+	Wavetable *wt = lhc_checkwavetable(L, 1);
+	lua_pushinteger(L, wt->nlevels);
+	return 1;
+}
+
+/* wt:render(n, freq [, phase [, rate]])
+ * freq and phase (in cycles) may be numbers or buffers */
+static int lhc_wavetable_render(lua_State *L)
+{
+	Wavetable *wt = lhc_checkwavetable(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "size must not be negative");
+	double rate   = luaL_optnumber(L, 5, 44100.);
+
+	const float *freq = NULL, *phase = NULL;
+	size_t size_freq = 0, size_phase = 0;
+	double f0 = 0., ph0 = 0.;
+
+	if (lua_isbuffer(L, 3) && lhc_buffer_nsamples(L, 3) > 0)
+	{
+		freq      = (const float *)lua_touserdata(L, 3);
+		size_freq = lhc_buffer_nsamples(L, 3);
+	}
+	else
+		f0 = luaL_checknumber(L, 3);
+
+	if (lua_isbuffer(L, 4) && lhc_buffer_nsamples(L, 4) > 0)
+	{
+		phase      = (const float *)lua_touserdata(L, 4);
+		size_phase = lhc_buffer_nsamples(L, 4);
+	}
+	else
+		ph0 = luaL_optnumber(L, 4, 0.);
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, n);
+	lua_call(L, 1, 1);
+	float *out = (float *)lua_touserdata(L, -1);
+
+	double size = (double)wt->size;
+	double p    = 0.;
+	double inc[WAVETABLE_BLOCKSIZE];
+	for (size_t pos = 0; pos < (size_t)n; pos += WAVETABLE_BLOCKSIZE)
+	{
+		size_t nb = (size_t)n - pos;
+		if (nb > WAVETABLE_BLOCKSIZE)
+			nb = WAVETABLE_BLOCKSIZE;
+
+		double inc_max = 0.;
+		for (size_t k = 0; k < nb; ++k)
+		{
+			double f = freq ? buffer_at(freq, size_freq, pos + k) : f0;
+			inc[k]   = f / rate;
+			if (fabs(inc[k]) > inc_max)
+				inc_max = fabs(inc[k]);
+		}
+
+		/* fastest frequency in the block picks the level */
+		int level = 0;
+		while (level < wt->nlevels - 1 && size / (double)(1 << level) * inc_max > 1.)
+			++level;
+		const float *t = wavetable_level(wt, level);
+
+		for (size_t k = 0; k < nb; ++k)
+		{
+			double ph = phase ? buffer_at(phase, size_phase, pos + k) : ph0;
+			double x  = p + ph;
+			x  = (x - floor(x)) * size;
+			size_t i  = (size_t)x;
+			if (i >= wt->size)
+				i = 0;
+			float fr  = (float)(x - (double)i);
+			out[pos + k] = t[i] + fr * (t[i+1] - t[i]);
+
+			p += inc[k];
+			p -= floor(p);
+		}
+	}
+
+	return 1;
+}
+
+static WavetableLRU *wavetable_lru(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, WAVETABLE_LRU);
+	WavetableLRU *lru = (WavetableLRU *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return lru;
+}
+
+static void wavetable_unlink(WavetableLRU *lru, Wavetable *wt)
+{
+	if (NULL != wt->prev)
+		wt->prev->next = wt->next;
+	else
+		lru->head = wt->next;
+
+	if (NULL != wt->next)
+		wt->next->prev = wt->prev;
+	else
+		lru->tail = wt->prev;
+
+	wt->prev = wt->next = NULL;
+}
+
+static void wavetable_push_front(WavetableLRU *lru, Wavetable *wt)
+{
+	wt->prev = NULL;
+	wt->next = lru->head;
+	if (NULL != lru->head)
+		lru->head->prev = wt;
+	lru->head = wt;
+	if (NULL == lru->tail)
+		lru->tail = wt;
+}
+
+/* drop least recently used tables from the cache table at idx until the
+ * cache fits into the budget. Dropped tables live on while referenced. */
+static void wavetable_trim(lua_State *L, WavetableLRU *lru, int idx)
+{
+	while (NULL != lru->tail && lru->used > lru->budget)
+	{
+		Wavetable *wt = lru->tail;
+		wavetable_unlink(lru, wt);
+		lru->used -= wt->bytes;
+		lru->entries--;
+
+		lua_pushnil(L);
+		lua_setfield(L, idx, wt->key);
+	}
+}
+
+/* lhc.wavetable(buffer) -- identical tables share one object while cached */
+int lhc_wavetable_new(lua_State *L)
+{
+	float *table = lhc_checkbuffer(L, 1);
+	size_t len   = lhc_buffer_nsamples(L, 1);
+	if (len < 2)
+		return luaL_argerror(L, 1, "table needs at least two samples");
+
+	char key[40];
+	snprintf(key, sizeof key, "%lu:%016llx", (unsigned long)len,
+			(unsigned long long)lhc_hash64(table, len * sizeof(float), 0));
+
+	WavetableLRU *lru = wavetable_lru(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, WAVETABLE_CACHE);
+	int cache_idx = lua_gettop(L);
+	lua_getfield(L, -1, key);
+	if (!lua_isnil(L, -1))
+	{
+		Wavetable *wt = (Wavetable *)lua_touserdata(L, -1);
+		wavetable_unlink(lru, wt);
+		wavetable_push_front(lru, wt);
+		return 1;
+	}
+	lua_pop(L, 1);
+
+	size_t size = WAVETABLE_MINSIZE;
+	while (size < len && size < WAVETABLE_MAXSIZE)
+		size <<= 1;
+
+	int nlevels = 0;
+	for (size_t h = size / 2; h > 0; h >>= 1)
+		++nlevels;
+
+	size_t bytes  = sizeof(Wavetable) + (size_t)nlevels * (size + 1) * sizeof(float);
+	Wavetable *wt = (Wavetable *)lua_newuserdata(L, bytes);
+	if (NULL == wt)
+		return luaL_error(L, "Cannot create wavetable");
+	wt->prev    = wt->next = NULL;
+	wt->bytes   = bytes;
+	wt->size    = size;
+	wt->nlevels = nlevels;
+	memcpy(wt->key, key, sizeof key);
+
+	if (!wavetable_build(wt, table, len))
+		return luaL_error(L, "Cannot allocate wavetable spectrum");
+
+	if (luaL_newmetatable(L, WAVETABLE_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_wavetable___len);
+		lua_setfield(L, -2, "__len");
+
+		lua_pushcfunction(L, lhc_wavetable_render);
+		lua_setfield(L, -2, "render");
+
+		lua_pushcfunction(L, lhc_wavetable_levels);
+		lua_setfield(L, -2, "levels");
+	}
+	lua_setmetatable(L, -2);
+
+	/* cache[key] = wavetable, unless it alone exceeds the budget */
+	if (bytes <= lru->budget)
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, cache_idx, key);
+		wavetable_push_front(lru, wt);
+		lru->used += bytes;
+		lru->entries++;
+		wavetable_trim(L, lru, cache_idx);
+	}
+
+	return 1;
+}
+
+/* lhc.wavetable.cache([budget]) -- set the memory budget of the wavetable
+ * cache in bytes. Returns bytes used, budget and number of entries. */
+static int lhc_wavetable_cache(lua_State *L)
+{
+	WavetableLRU *lru = wavetable_lru(L);
+	if (!lua_isnoneornil(L, 1))
+	{
+		lua_Number budget = luaL_checknumber(L, 1);
+		luaL_argcheck(L, budget >= 0, 1, "budget must not be negative");
+		lru->budget = (size_t)budget;
+
+		lua_getfield(L, LUA_REGISTRYINDEX, WAVETABLE_CACHE);
+		wavetable_trim(L, lru, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+
+	lua_pushnumber(L, lru->used);
+	lua_pushnumber(L, lru->budget);
+	lua_pushinteger(L, lru->entries);
+	return 3;
+}
+
+static int lhc_wavetable___call(lua_State *L)
+{
+	lua_remove(L, 1);
+	return lhc_wavetable_new(L);
+}
+
+int luaopen_lhc_wavetable(lua_State *L)
+{
+	/* recently used tables stay cached within a byte budget */
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, WAVETABLE_CACHE);
+
+	WavetableLRU *lru = (WavetableLRU *)lua_newuserdata(L, sizeof(WavetableLRU));
+	memset(lru, 0, sizeof(WavetableLRU));
+	lru->budget = WAVETABLE_BUDGET;
+	lua_setfield(L, LUA_REGISTRYINDEX, WAVETABLE_LRU);
+
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lhc_wavetable_cache);
+	lua_setfield(L, -2, "cache");
+
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lhc_wavetable___call);
+	lua_setfield(L, -2, "__call");
+	lua_setmetatable(L, -2);
+	return 1;
+}
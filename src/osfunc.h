@@ -1,3 +1,46 @@
 #pragma once
 
+#include <stddef.h>
+
 int hres_sleep(double t);
+double hres_time(void);
+int cpu_count(void);
+/* differs between processes running at the same time */
+unsigned long process_id(void);
+
+/* modification time and size of a file; returns 0 if it does not exist */
+int file_stat(const char *path, double *mtime, size_t *size);
+/* set the modification time of a file to now */
+int file_touch(const char *path);
+/* atomically move a file over another one in the same directory */
+int file_replace(const char *from, const char *to);
+/* create a directory unless it exists */
+int dir_create(const char *path);
+/* call func for every entry of a directory, except hidden ones */
+int dir_list(const char *path, void (*func)(const char *name, void *ud), void *ud);
+
+/* threads and synchronization */
+typedef struct os_thread os_thread;
+typedef struct os_mutex  os_mutex;
+typedef struct os_cond   os_cond;
+
+os_thread *thread_create(void *(*func)(void *), void *arg);
+void *thread_join(os_thread *t);
+
+os_mutex *mutex_create(void);
+void mutex_destroy(os_mutex *m);
+void mutex_lock(os_mutex *m);
+void mutex_unlock(os_mutex *m);
+
+os_cond *cond_create(void);
+void cond_destroy(os_cond *c);
+void cond_wait(os_cond *c, os_mutex *m);
+int cond_timedwait(os_cond *c, os_mutex *m, double t);
+void cond_signal(os_cond *c);
+void cond_broadcast(os_cond *c);
+
+/* atomics (gcc/clang builtins) */
+#define atomic_get(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_set(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_fence()   __atomic_thread_fence(__ATOMIC_SEQ_CST)
@@ -1,8 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
 #include "osfunc.h"
-#ifdef __linux__
-#include <linux/time.h>
-#endif
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
 
 #include <stdio.h>
 
@@ -13,3 +17,160 @@ int hres_sleep(double t)
 	delay.tv_nsec = (long)((t - (double)delay.tv_sec) * 1000000000);
 	return 0 == nanosleep(&delay, NULL);
 }
+
+double hres_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+int cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+unsigned long process_id(void)
+{
+	return (unsigned long)getpid();
+}
+
+int file_stat(const char *path, double *mtime, size_t *size)
+{
+	struct stat st;
+	if (0 != stat(path, &st))
+		return 0;
+
+	if (NULL != mtime)
+		*mtime = (double)st.st_mtim.tv_sec + (double)st.st_mtim.tv_nsec * 1e-9;
+	if (NULL != size)
+		*size = (size_t)st.st_size;
+	return 1;
+}
+
+int file_touch(const char *path)
+{
+	return 0 == utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+int file_replace(const char *from, const char *to)
+{
+	return 0 == rename(from, to);
+}
+
+int dir_create(const char *path)
+{
+	struct stat st;
+	if (0 == stat(path, &st))
+		return S_ISDIR(st.st_mode);
+	return 0 == mkdir(path, 0777);
+}
+
+int dir_list(const char *path, void (*func)(const char *name, void *ud), void *ud)
+{
+	DIR *dir = opendir(path);
+	if (NULL == dir)
+		return 0;
+
+	struct dirent *entry;
+	while (NULL != (entry = readdir(dir)))
+		if ('.' != entry->d_name[0])
+			func(entry->d_name, ud);
+
+	closedir(dir);
+	return 1;
+}
+
+struct os_thread { pthread_t handle; };
+struct os_mutex  { pthread_mutex_t handle; };
+struct os_cond   { pthread_cond_t handle; };
+
+os_thread *thread_create(void *(*func)(void *), void *arg)
+{
+	os_thread *t = malloc(sizeof(os_thread));
+	if (NULL == t)
+		return NULL;
+
+	if (0 != pthread_create(&t->handle, NULL, func, arg))
+	{
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void *thread_join(os_thread *t)
+{
+	void *ret = NULL;
+	pthread_join(t->handle, &ret);
+	free(t);
+	return ret;
+}
+
+os_mutex *mutex_create(void)
+{
+	os_mutex *m = malloc(sizeof(os_mutex));
+	if (NULL != m)
+		pthread_mutex_init(&m->handle, NULL);
+	return m;
+}
+
+void mutex_destroy(os_mutex *m)
+{
+	pthread_mutex_destroy(&m->handle);
+	free(m);
+}
+
+void mutex_lock(os_mutex *m)
+{
+	pthread_mutex_lock(&m->handle);
+}
+
+void mutex_unlock(os_mutex *m)
+{
+	pthread_mutex_unlock(&m->handle);
+}
+
+os_cond *cond_create(void)
+{
+	os_cond *c = malloc(sizeof(os_cond));
+	if (NULL != c)
+		pthread_cond_init(&c->handle, NULL);
+	return c;
+}
+
+void cond_destroy(os_cond *c)
+{
+	pthread_cond_destroy(&c->handle);
+	free(c);
+}
+
+void cond_wait(os_cond *c, os_mutex *m)
+{
+	pthread_cond_wait(&c->handle, &m->handle);
+}
+
+int cond_timedwait(os_cond *c, os_mutex *m, double t)
+{
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec  += (time_t)t;
+	until.tv_nsec += (long)((t - (double)(time_t)t) * 1000000000);
+	if (until.tv_nsec >= 1000000000)
+	{
+		until.tv_sec  += 1;
+		until.tv_nsec -= 1000000000;
+	}
+	return 0 == pthread_cond_timedwait(&c->handle, &m->handle, &until);
+}
+
+void cond_signal(os_cond *c)
+{
+	pthread_cond_signal(&c->handle);
+}
+
+void cond_broadcast(os_cond *c)
+{
+	pthread_cond_broadcast(&c->handle);
+}
@@ -0,0 +1,442 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "osfunc.h"
+#include "overview.h"
+#include "parallel.h"
+
+#define OVERVIEW_BASE      64
+#define OVERVIEW_MAXLEVELS 64
+#define OVERVIEW_GRAIN     1024
+#define OVERVIEW_MAGIC     "LHCOVW\001"
+
+static const char *INTERNAL_NAME = "lhc.overview";
+
+/*
+ * Level 0 summarizes blocks of OVERVIEW_BASE samples, every further level
+ * combines two entries of the level below, up to a single entry for the
+ * whole buffer.
+ */
+typedef struct {
+	float  min, max;
+	double sumsq;
+} OverviewEntry;
+
+typedef struct {
+	size_t         n;
+	int            nlevels;
+	size_t         count[OVERVIEW_MAXLEVELS];
+	size_t         offset[OVERVIEW_MAXLEVELS];
+	OverviewEntry *entries;
+	char          *soundfile; /* persist next to this file, may be NULL */
+} Overview;
+
+/* sidecar file header; entries follow in host byte order */
+typedef struct {
+	char     magic[8];
+	uint64_t nsamples;
+	uint64_t filesize;
+	double   mtime;
+	uint32_t base;
+	uint32_t nlevels;
+} OverviewHeader;
+
+typedef struct {
+	float  min, max;
+	double sumsq;
+} OverviewStats;
+
+inline static void stats_add(OverviewStats *s, const OverviewEntry *e)
+{
+	s->min    = fminf(s->min, e->min);
+	s->max    = fmaxf(s->max, e->max);
+	s->sumsq += e->sumsq;
+}
+
+static void stats_scan(OverviewStats *s, const float *buf, size_t a, size_t b)
+{
+	for (size_t i = a; i < b; ++i)
+	{
+		s->min    = fminf(s->min, buf[i]);
+		s->max    = fmaxf(s->max, buf[i]);
+		s->sumsq += (double)buf[i] * buf[i];
+	}
+}
+
+static size_t overview_layout(Overview *ov, size_t n)
+{
+	size_t total = 0;
+	size_t count = n > 0 ? (n + OVERVIEW_BASE - 1) / OVERVIEW_BASE : 0;
+
+	ov->n       = n;
+	ov->nlevels = 0;
+	while (count > 0 && ov->nlevels < OVERVIEW_MAXLEVELS)
+	{
+		ov->count[ov->nlevels]  = count;
+		ov->offset[ov->nlevels] = total;
+		ov->nlevels++;
+		total += count;
+
+		if (1 == count)
+			break;
+		count = (count + 1) / 2;
+	}
+
+	return total;
+}
+
+typedef struct {
+	const float   *buf;
+	size_t         n;
+	OverviewEntry *level;
+} OverviewJob;
+
+static void overview_base_blocks(void *ud, size_t begin, size_t end)
+{
+	OverviewJob *job = (OverviewJob *)ud;
+	for (size_t k = begin; k < end; ++k)
+	{
+		size_t a = k * OVERVIEW_BASE;
+		size_t b = a + OVERVIEW_BASE < job->n ? a + OVERVIEW_BASE : job->n;
+		OverviewStats s = {FLT_MAX, -FLT_MAX, 0.};
+		stats_scan(&s, job->buf, a, b);
+
+		job->level[k].min   = s.min;
+		job->level[k].max   = s.max;
+		job->level[k].sumsq = s.sumsq;
+	}
+}
+
+static void overview_build(Overview *ov, const float *buf)
+{
+	if (0 == ov->nlevels)
+		return;
+
+	OverviewJob job = {buf, ov->n, ov->entries};
+	parallel_for(ov->count[0], OVERVIEW_GRAIN, overview_base_blocks, &job);
+
+	for (int l = 1; l < ov->nlevels; ++l)
+	{
+		const OverviewEntry *lower = ov->entries + ov->offset[l-1];
+		OverviewEntry *level       = ov->entries + ov->offset[l];
+		for (size_t k = 0; k < ov->count[l]; ++k)
+		{
+			level[k] = lower[2*k];
+			if (2*k + 1 < ov->count[l-1])
+			{
+				level[k].min    = fminf(level[k].min, lower[2*k+1].min);
+				level[k].max    = fmaxf(level[k].max, lower[2*k+1].max);
+				level[k].sumsq += lower[2*k+1].sumsq;
+			}
+		}
+	}
+}
+
+/* statistics of samples [a, b): raw samples at the ragged ends, at most
+ * two entries per level in between */
+static OverviewStats overview_range(const Overview *ov, const float *buf, size_t a, size_t b)
+{
+	OverviewStats s = {FLT_MAX, -FLT_MAX, 0.};
+
+	size_t A = (a + OVERVIEW_BASE - 1) / OVERVIEW_BASE;
+	size_t B = b / OVERVIEW_BASE;
+	if (A >= B)
+	{
+		stats_scan(&s, buf, a, b);
+		return s;
+	}
+
+	stats_scan(&s, buf, a, A * OVERVIEW_BASE);
+	stats_scan(&s, buf, B * OVERVIEW_BASE, b);
+
+	for (int l = 0; l < ov->nlevels && A < B; ++l)
+	{
+		const OverviewEntry *level = ov->entries + ov->offset[l];
+		if (A & 1)
+			stats_add(&s, &level[A++]);
+		if (B & 1)
+			stats_add(&s, &level[--B]);
+		A >>= 1;
+		B >>= 1;
+	}
+
+	return s;
+}
+
+static char *overview_sidecar_path(const char *soundfile)
+{
+	size_t len = strlen(soundfile);
+	char *path = malloc(len + sizeof(".overview"));
+	if (NULL != path)
+	{
+		memcpy(path, soundfile, len);
+		memcpy(path + len, ".overview", sizeof(".overview"));
+	}
+	return path;
+}
+
+static int overview_load(Overview *ov, size_t total)
+{
+	double mtime;
+	size_t filesize;
+	if (!file_stat(ov->soundfile, &mtime, &filesize))
+		return 0;
+
+	char *path = overview_sidecar_path(ov->soundfile);
+	FILE *f    = NULL != path ? fopen(path, "rb") : NULL;
+	free(path);
+	if (NULL == f)
+		return 0;
+
+	OverviewHeader h;
+	int ok = 1 == fread(&h, sizeof h, 1, f)
+		&& 0 == memcmp(h.magic, OVERVIEW_MAGIC, sizeof h.magic)
+		&& h.nsamples == ov->n && h.filesize == filesize && h.mtime == mtime
+		&& h.base == OVERVIEW_BASE && h.nlevels == (uint32_t)ov->nlevels
+		&& total == fread(ov->entries, sizeof(OverviewEntry), total, f);
+
+	fclose(f);
+	return ok;
+}
+
+static void overview_save(const Overview *ov, size_t total)
+{
+	OverviewHeader h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, OVERVIEW_MAGIC, sizeof h.magic);
+	h.nsamples = ov->n;
+	h.base     = OVERVIEW_BASE;
+	h.nlevels  = ov->nlevels;
+
+	double mtime;
+	size_t filesize;
+	if (!file_stat(ov->soundfile, &mtime, &filesize))
+		return;
+	h.filesize = filesize;
+	h.mtime    = mtime;
+
+	char *path = overview_sidecar_path(ov->soundfile);
+	FILE *f    = NULL != path ? fopen(path, "wb") : NULL;
+	free(path);
+	if (NULL == f)
+		return;
+
+	fwrite(&h, sizeof h, 1, f);
+	fwrite(ov->entries, sizeof(OverviewEntry), total, f);
+	fclose(f);
+}
+
+static Overview *lhc_checkoverview(lua_State *L, int idx)
+{
+	return (Overview *)luaL_checkudata(L, idx, INTERNAL_NAME);
+}
+
+/* the buffer summarized by the overview at idx */
+static float *overview_buffer(lua_State *L, int idx)
+{
+	lua_getfenv(L, idx);
+	lua_rawgeti(L, -1, 1);
+	float *buf = (float *)lua_touserdata(L, -1);
+	lua_pop(L, 2);
+	return buf;
+}
+
+/* overview:peaks([i, j,] bins) -- min, max and rms of samples i..j in
+ * `bins' equally sized bins, returned as three buffers */
+static int lhc_overview_peaks(lua_State *L)
+{
+	Overview *ov = lhc_checkoverview(L, 1);
+	lua_Integer i, j, bins;
+	if (lua_gettop(L) >= 3)
+	{
+		i    = luaL_checkinteger(L, 2);
+		j    = luaL_checkinteger(L, 3);
+		bins = luaL_optinteger(L, 4, 1024);
+	}
+	else
+	{
+		i    = 1;
+		j    = (lua_Integer)ov->n;
+		bins = luaL_optinteger(L, 2, 1024);
+	}
+
+	luaL_argcheck(L, i >= 1 && i <= j && (size_t)j <= ov->n, 2, "range out of bounds");
+	luaL_argcheck(L, bins > 0, 4, "need at least one bin");
+
+	float *buf = overview_buffer(L, 1);
+	float *out[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		lua_pushcfunction(L, lhc_buffer_new);
+		lua_pushinteger(L, bins);
+		lua_call(L, 1, 1);
+		out[k] = (float *)lua_touserdata(L, -1);
+	}
+
+	size_t a0  = (size_t)i - 1;
+	size_t len = (size_t)(j - i + 1);
+	for (size_t k = 0; k < (size_t)bins; ++k)
+	{
+		size_t a = a0 + k * len / bins;
+		size_t b = a0 + (k + 1) * len / bins;
+		if (b <= a)
+			b = a + 1;
+
+		OverviewStats s = overview_range(ov, buf, a, b);
+		out[0][k] = s.min;
+		out[1][k] = s.max;
+		out[2][k] = (float)sqrt(s.sumsq / (double)(b - a));
+	}
+
+	return 3;
+}
+
+/* overview:update() -- rebuild after the buffer was changed */
+static int lhc_overview_update(lua_State *L)
+{
+	Overview *ov = lhc_checkoverview(L, 1);
+	overview_build(ov, overview_buffer(L, 1));
+	if (NULL != ov->soundfile)
+		overview_save(ov, overview_layout(ov, ov->n));
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_overview_levels(lua_State *L)
+{
+	lua_pushinteger(L, lhc_checkoverview(L, 1)->nlevels);
+	return 1;
+}
+
+static int lhc_overview___len(lua_State *L)
+{
+	lua_pushinteger(L, lhc_checkoverview(L, 1)->n);
+	return 1;
+}
+
+static int lhc_overview___gc(lua_State *L)
+{
+	Overview *ov = (Overview *)lua_touserdata(L, 1);
+	free(ov->entries);
+	free(ov->soundfile);
+	ov->entries   = NULL;
+	ov->soundfile = NULL;
+	return 0;
+}
+
+int lhc_buffer_overview(lua_State *L)
+{
+	float *buf            = lhc_checkbuffer(L, 1);
+	const char *soundfile = luaL_optstring(L, 2, NULL);
+	lua_settop(L, 2);
+
+	/* overviews are cached in the environment of the buffer */
+	lua_getfenv(L, 1);
+	if (!lua_istable(L, -1) || lua_rawequal(L, -1, LUA_GLOBALSINDEX))
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfenv(L, 1);
+	}
+
+	lua_pushlightuserdata(L, (void *)INTERNAL_NAME);
+	lua_rawget(L, -2);
+	if (!lua_isnil(L, -1))
+		return 1;
+	lua_pop(L, 1);
+
+	Overview *ov = (Overview *)lua_newuserdata(L, sizeof(Overview));
+	memset(ov, 0, sizeof(Overview));
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_overview___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_overview___len);
+		lua_setfield(L, -2, "__len");
+
+		lua_pushcfunction(L, lhc_overview_peaks);
+		lua_setfield(L, -2, "peaks");
+
+		lua_pushcfunction(L, lhc_overview_update);
+		lua_setfield(L, -2, "update");
+
+		lua_pushcfunction(L, lhc_overview_levels);
+		lua_setfield(L, -2, "levels");
+	}
+	lua_setmetatable(L, -2);
+
+	/* keep the buffer alive */
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+
+	size_t total = overview_layout(ov, lhc_buffer_nsamples(L, 1));
+	ov->entries  = malloc(total * sizeof(OverviewEntry) + 1);
+	if (NULL == ov->entries)
+		return luaL_error(L, "Cannot create overview");
+
+	if (NULL != soundfile)
+	{
+		ov->soundfile = malloc(strlen(soundfile) + 1);
+		if (NULL != ov->soundfile)
+			strcpy(ov->soundfile, soundfile);
+	}
+
+	if (NULL == ov->soundfile || !overview_load(ov, total))
+	{
+		overview_build(ov, buf);
+		if (NULL != ov->soundfile)
+			overview_save(ov, total);
+	}
+
+	lua_pushlightuserdata(L, (void *)INTERNAL_NAME);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, -4);
+	return 1;
+}
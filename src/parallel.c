@@ -0,0 +1,150 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "osfunc.h"
+#include "parallel.h"
+
+#define PARALLEL_MAXTHREADS 64
+
+struct parallel_task {
+	size_t         n;
+	size_t         grain;
+	size_t         nchunks;
+	size_t         next;
+	size_t         done;
+	parallel_func  func;
+	void          *ud;
+	int            nthreads;
+	os_thread     *threads[PARALLEL_MAXTHREADS];
+};
+
+static int num_threads = 0;
+
+int parallel_threads(void)
+{
+	int n = num_threads > 0 ? num_threads : cpu_count();
+	return n < PARALLEL_MAXTHREADS ? n : PARALLEL_MAXTHREADS;
+}
+
+void parallel_set_threads(int n)
+{
+	num_threads = n;
+}
+
+static void *parallel_worker(void *arg)
+{
+	parallel_task *t = (parallel_task *)arg;
+	for (;;)
+	{
+		size_t chunk = atomic_add(&t->next, 1);
+		if (chunk >= t->nchunks)
+			break;
+
+		size_t begin = chunk * t->grain;
+		size_t end   = begin + t->grain < t->n ? begin + t->grain : t->n;
+		t->func(t->ud, begin, end);
+		atomic_add(&t->done, end - begin);
+	}
+	return NULL;
+}
+
+static parallel_task *parallel_task_new(size_t n, size_t grain, parallel_func func, void *ud)
+{
+	parallel_task *t = malloc(sizeof(parallel_task));
+	if (NULL == t)
+		return NULL;
+
+	t->n        = n;
+	t->grain    = grain > 0 ? grain : 1;
+	t->nchunks  = (n + t->grain - 1) / t->grain;
+	t->next     = 0;
+	t->done     = 0;
+	t->func     = func;
+	t->ud       = ud;
+	t->nthreads = 0;
+	return t;
+}
+
+static void parallel_spawn(parallel_task *t, int nthreads)
+{
+	if ((size_t)nthreads > t->nchunks)
+		nthreads = (int)t->nchunks;
+	if (nthreads > PARALLEL_MAXTHREADS)
+		nthreads = PARALLEL_MAXTHREADS;
+
+	for (int i = 0; i < nthreads; ++i)
+	{
+		os_thread *thread = thread_create(parallel_worker, t);
+		if (NULL == thread)
+			break;
+		t->threads[t->nthreads++] = thread;
+	}
+}
+
+void parallel_for(size_t n, size_t grain, parallel_func func, void *ud)
+{
+	parallel_task *t = parallel_task_new(n, grain, func, ud);
+	if (NULL == t)
+	{
+		func(ud, 0, n);
+		return;
+	}
+
+	/* the calling thread is a worker too */
+	if (t->nchunks > 1)
+		parallel_spawn(t, parallel_threads() - 1);
+	parallel_worker(t);
+	parallel_wait(t);
+}
+
+parallel_task *parallel_start(size_t n, size_t grain, int nthreads, parallel_func func, void *ud)
+{
+	parallel_task *t = parallel_task_new(n, grain, func, ud);
+	if (NULL == t)
+		return NULL;
+
+	parallel_spawn(t, nthreads > 0 ? nthreads : parallel_threads());
+	if (0 == t->nthreads)
+		parallel_worker(t);
+	return t;
+}
+
+size_t parallel_done(parallel_task *t)
+{
+	return atomic_get(&t->done);
+}
+
+void parallel_wait(parallel_task *t)
+{
+	for (int i = 0; i < t->nthreads; ++i)
+		thread_join(t->threads[i]);
+	free(t);
+}
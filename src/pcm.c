@@ -0,0 +1,162 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm.h"
+
+#define PCM_BLOCKSIZE 1024
+#define PCM_SOFTKNEE  .8f
+
+pcm_converter *pcm_converter_new(int bits, int channels, int dither, int clip, uint64_t seed)
+{
+	pcm_converter *c = malloc(sizeof(pcm_converter) + 2 * channels * sizeof(float));
+	if (NULL == c)
+		return NULL;
+
+	c->bits     = bits;
+	c->channels = channels;
+	c->dither   = dither;
+	c->clip     = clip;
+	c->channel  = 0;
+	lhc_rng_seed(&c->rng, seed, 0);
+	memset(c->err, 0, 2 * channels * sizeof(float));
+	return c;
+}
+
+void pcm_converter_free(pcm_converter *c)
+{
+	free(c);
+}
+
+/* smooth saturation above the knee, linear below */
+static void pcm_softclip(float *x, size_t n)
+{
+	const float range = 1.f - PCM_SOFTKNEE;
+	for (size_t i = 0; i < n; ++i)
+	{
+		float a = fabsf(x[i]);
+		if (a > PCM_SOFTKNEE)
+			x[i] = copysignf(PCM_SOFTKNEE + range * tanhf((a - PCM_SOFTKNEE) / range), x[i]);
+	}
+}
+
+/*
+ * Scales one block to integer range, adding dither. The result is still
+ * float; rounding and clamping happen in the branch free store loops,
+ * which the compiler can vectorize.
+ */
+static void pcm_prepare(pcm_converter *c, const float *in, float *x, size_t n, float scale)
+{
+	for (size_t i = 0; i < n; ++i)
+		x[i] = in[i];
+
+	if (PCM_CLIP_SOFT == c->clip)
+		pcm_softclip(x, n);
+
+	for (size_t i = 0; i < n; ++i)
+		x[i] *= scale;
+
+	if (PCM_DITHER_TPDF == c->dither)
+	{
+		/* difference of two uniform variables: triangular in (-1, 1) LSB.
+		 * Each comes from its own draw, using only the high bits. */
+		for (size_t i = 0; i < n; ++i)
+		{
+			float a = lhc_rng_float(&c->rng);
+			float b = lhc_rng_float(&c->rng);
+			x[i] += a - b;
+		}
+	}
+	else if (PCM_DITHER_SHAPED == c->dither)
+	{
+		/* TPDF dither with second order error feedback: the requantization
+		 * noise is shaped by (1 - z^-1)^2, moving it to high frequencies */
+		size_t ch = c->channel;
+		for (size_t i = 0; i < n; ++i)
+		{
+			float *e = c->err + 2 * ch;
+			float a = lhc_rng_float(&c->rng);
+			float b = lhc_rng_float(&c->rng);
+
+			float w = x[i] - 2.f * e[0] + e[1];
+			float y = floorf(w + a - b + .5f);
+			e[1] = e[0];
+			e[0] = y - w;
+			x[i] = y;
+
+			if (++ch == (size_t)c->channels)
+				ch = 0;
+		}
+	}
+
+	c->channel = (c->channel + n) % c->channels;
+}
+
+void pcm_convert_short(pcm_converter *c, const float *in, short *out, size_t n)
+{
+	float x[PCM_BLOCKSIZE];
+	while (n > 0)
+	{
+		size_t k = n < PCM_BLOCKSIZE ? n : PCM_BLOCKSIZE;
+		pcm_prepare(c, in, x, k, 32768.f);
+
+		for (size_t i = 0; i < k; ++i)
+		{
+			float y = x[i];
+			y = y < -32768.f ? -32768.f : y;
+			y = y >  32767.f ?  32767.f : y;
+			out[i] = (short)(int)(y + (y < 0.f ? -.5f : .5f));
+		}
+
+		in += k; out += k; n -= k;
+	}
+}
+
+void pcm_convert_int(pcm_converter *c, const float *in, int *out, size_t n)
+{
+	float x[PCM_BLOCKSIZE];
+	while (n > 0)
+	{
+		size_t k = n < PCM_BLOCKSIZE ? n : PCM_BLOCKSIZE;
+		pcm_prepare(c, in, x, k, 8388608.f);
+
+		for (size_t i = 0; i < k; ++i)
+		{
+			float y = x[i];
+			y = y < -8388608.f ? -8388608.f : y;
+			y = y >  8388607.f ?  8388607.f : y;
+			out[i] = (int)(y + (y < 0.f ? -.5f : .5f)) * 256;
+		}
+
+		in += k; out += k; n -= k;
+	}
+}
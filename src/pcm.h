@@ -0,0 +1,64 @@
+#pragma once
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "noise.h"
+
+enum { PCM_DITHER_NONE, PCM_DITHER_TPDF, PCM_DITHER_SHAPED };
+enum { PCM_CLIP_HARD, PCM_CLIP_SOFT };
+
+/* float to integer conversion with dither, noise shaping and clipping */
+typedef struct {
+	int     bits;     /* 16 or 24 */
+	int     channels;
+	int     dither;
+	int     clip;
+	size_t  channel;  /* channel of the next sample */
+	lhc_rng rng;
+	float   err[];    /* two past quantization errors per channel */
+} pcm_converter;
+
+pcm_converter *pcm_converter_new(int bits, int channels, int dither, int clip, uint64_t seed);
+void pcm_converter_free(pcm_converter *c);
+
+/* 16 bit samples */
+void pcm_convert_short(pcm_converter *c, const float *in, short *out, size_t n);
+/* 24 bit samples, left aligned in 32 bits as libsndfile expects */
+void pcm_convert_int(pcm_converter *c, const float *in, int *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
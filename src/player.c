@@ -31,83 +31,603 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "buffer.h"
+#include "engine.h"
+#include "osfunc.h"
 #include "player.h"
+#include "stream.h"
 
 static const char *INTERNAL_NAME = "lhc.player-instance";
 static const char *CLEANUP_NAME  = "lhc.player.cleanup";
-static const char *BUFFERS_NAME  = "lhc.player.cleanup";
+static const char *BUFFERS_NAME  = "lhc.player.buffers";
 
-static int pa_stream_callback(const void* inputBuffer, void* outputBuffer,
-		unsigned long frames, const PaStreamCallbackTimeInfo* timeinfo,
-		PaStreamCallbackFlags status, void* udata)
+static PlayerStats player_stats_total;
+
+static void player_stats_add(PlayerStats *stats, PaStreamCallbackFlags status, unsigned int usec, int bin)
 {
-	(void)inputBuffer;
-	(void)timeinfo;
-	(void)status;
+	atomic_add(&stats->callbacks, 1);
+	if (status & paOutputUnderflow)
+		atomic_add(&stats->underflows, 1);
+	if (status & paOutputOverflow)
+		atomic_add(&stats->overflows, 1);
+	atomic_add(&stats->total_usec, usec);
+	atomic_add(&stats->histogram[bin], 1);
+
+	/* may lose against a concurrent stream, which is fine for a maximum */
+	if (usec > atomic_get(&stats->max_usec))
+		atomic_set(&stats->max_usec, usec);
+}
 
-	PlayerInstance* pi = (PlayerInstance*)udata;
+void player_stats_record(PlayerStats *stats, PaStreamCallbackFlags status, double start)
+{
+	unsigned int usec = (unsigned int)((hres_time() - start) * 1e6);
+	int bin = 0;
+	while (bin < PLAYER_HISTOGRAM - 1 && (usec >> bin) > 0)
+		++bin;
+
+	player_stats_add(stats, status, usec, bin);
+	player_stats_add(&player_stats_total, status, usec, bin);
+}
+
+int lhc_player_pushstats(lua_State *L, PlayerStats *stats, PaStream *stream)
+{
+	unsigned int callbacks = atomic_get(&stats->callbacks);
+	double total = (double)atomic_get(&stats->total_usec) * 1e-6;
+
+	lua_createtable(L, 0, 9);
+
+	lua_pushinteger(L, callbacks);
+	lua_setfield(L, -2, "callbacks");
+
+	lua_pushinteger(L, atomic_get(&stats->underflows));
+	lua_setfield(L, -2, "underflows");
+
+	lua_pushinteger(L, atomic_get(&stats->overflows));
+	lua_setfield(L, -2, "overflows");
+
+	lua_pushnumber(L, (double)atomic_get(&stats->max_usec) * 1e-6);
+	lua_setfield(L, -2, "max_time");
+
+	lua_pushnumber(L, callbacks > 0 ? total / callbacks : 0.);
+	lua_setfield(L, -2, "mean_time");
+
+	lua_createtable(L, PLAYER_HISTOGRAM, 0);
+	int i;
+	for (i = 0; i < PLAYER_HISTOGRAM; ++i)
+	{
+		lua_pushinteger(L, atomic_get(&stats->histogram[i]));
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_setfield(L, -2, "histogram");
+
+	if (NULL != stream)
+	{
+		lua_pushnumber(L, Pa_GetStreamCpuLoad(stream));
+		lua_setfield(L, -2, "cpu_load");
+
+		const PaStreamInfo *info = Pa_GetStreamInfo(stream);
+		if (NULL != info)
+		{
+			lua_pushnumber(L, info->outputLatency);
+			lua_setfield(L, -2, "latency");
+
+			lua_pushnumber(L, info->sampleRate);
+			lua_setfield(L, -2, "samplerate");
+		}
+	}
+
+	return 1;
+}
+
+static void player_apply(PlayerInstance *pi, const PlayerCommand *cmd)
+{
+	switch (cmd->type)
+	{
+		case PLAYER_CMD_SEEK:
+			pi->sample_pos = (size_t)cmd->value;
+			if (pi->sample_pos > pi->nsamples)
+				pi->sample_pos = pi->nsamples;
+			break;
+		case PLAYER_CMD_GAIN:
+			pi->target_gain = (float)cmd->value;
+			break;
+		case PLAYER_CMD_LOOP:
+			pi->is_looping = 0. != cmd->value;
+			break;
+	}
+}
+
+static void player_drain_commands(PlayerInstance *pi)
+{
+	unsigned int read = pi->cmd_read, write = atomic_get(&pi->cmd_write);
+	for (; read != write; ++read)
+		player_apply(pi, &pi->commands[read % PLAYER_QUEUESIZE]);
+	atomic_set(&pi->cmd_read, read);
+}
+
+static void player_publish(PlayerInstance *pi, size_t pos, size_t frames, double time)
+{
+	PlayerState *st = &pi->state;
+	atomic_add(&st->seq, 1);
+	atomic_fence();
+	st->pos        = pos;
+	st->frames     = frames;
+	st->time       = time;
+	st->nsamples   = pi->nsamples;
+	st->gain       = pi->target_gain;
+	st->is_looping = pi->is_looping;
+	atomic_fence();
+	atomic_add(&st->seq, 1);
+}
+
+static void player_snapshot(PlayerInstance *pi, PlayerState *out)
+{
+	unsigned int seq;
+	do
+	{
+		while ((seq = atomic_get(&pi->state.seq)) & 1)
+			;
+		atomic_fence();
+		*out = pi->state;
+		atomic_fence();
+	} while (seq != atomic_get(&pi->state.seq));
+}
+
+/* host API by index or (part of its) name */
+static PaHostApiIndex player_findhostapi(lua_State *L, int idx)
+{
+	PaHostApiIndex i, n = Pa_GetHostApiCount();
+	if (lua_type(L, idx) == LUA_TNUMBER)
+	{
+		i = (PaHostApiIndex)lua_tointeger(L, idx);
+		if (i < 0 || i >= n)
+			luaL_error(L, "Invalid host API: %d", i);
+		return i;
+	}
+
+	const char *name = luaL_checkstring(L, idx);
+	for (i = 0; i < n; ++i)
+	{
+		const PaHostApiInfo *info = Pa_GetHostApiInfo(i);
+		if (NULL != info && NULL != strstr(info->name, name))
+			return i;
+	}
+
+	luaL_error(L, "No host API matching `%s'", name);
+	return -1;
+}
+
+/* output device by index or name. An exact name match wins over a partial one. */
+static PaDeviceIndex player_finddevice(lua_State *L, int idx, PaHostApiIndex hostapi)
+{
+	PaDeviceIndex i, n = Pa_GetDeviceCount(), found = paNoDevice;
+	if (lua_type(L, idx) == LUA_TNUMBER)
+	{
+		i = (PaDeviceIndex)lua_tointeger(L, idx);
+		const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+		if (i < 0 || i >= n || NULL == info || info->maxOutputChannels <= 0)
+			luaL_error(L, "Invalid output device: %d", i);
+		return i;
+	}
+
+	const char *name = luaL_checkstring(L, idx);
+	for (i = 0; i < n; ++i)
+	{
+		const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+		if (NULL == info || info->maxOutputChannels <= 0)
+			continue;
+		if (hostapi >= 0 && info->hostApi != hostapi)
+			continue;
+
+		if (0 == strcmp(info->name, name))
+			return i;
+		if (paNoDevice == found && NULL != strstr(info->name, name))
+			found = i;
+	}
+
+	if (paNoDevice == found)
+		luaL_error(L, "No output device matching `%s'", name);
+	return found;
+}
+
+void player_checkoptions(lua_State *L, int idx, PlayerOptions *opts)
+{
+	opts->device     = paNoDevice;
+	opts->frames     = paFramesPerBufferUnspecified;
+	opts->latency    = PLAYER_LATENCY_HIGH;
+	opts->is_looping = 0;
+
+	if (!lua_istable(L, idx))
+	{
+		opts->is_looping = lua_toboolean(L, idx);
+		return;
+	}
+
+	lua_getfield(L, idx, "loop");
+	opts->is_looping = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	PaHostApiIndex hostapi = -1;
+	lua_getfield(L, idx, "hostapi");
+	if (!lua_isnil(L, -1))
+		hostapi = player_findhostapi(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "device");
+	if (!lua_isnil(L, -1))
+		opts->device = player_finddevice(L, -1, hostapi);
+	else if (hostapi >= 0)
+		opts->device = Pa_GetHostApiInfo(hostapi)->defaultOutputDevice;
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "framesPerBuffer");
+	lua_Integer frames = luaL_optinteger(L, -1, paFramesPerBufferUnspecified);
+	if (frames < 0)
+		luaL_error(L, "Invalid frames per buffer: %d", (int)frames);
+	opts->frames = (unsigned long)frames;
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "latency");
+	if (lua_type(L, -1) == LUA_TNUMBER)
+	{
+		opts->latency = lua_tonumber(L, -1);
+		if (opts->latency < 0.)
+			luaL_error(L, "Invalid latency: %f", opts->latency);
+	}
+	else if (!lua_isnil(L, -1))
+	{
+		const char *latency = luaL_checkstring(L, -1);
+		if (0 == strcmp(latency, "low"))
+			opts->latency = PLAYER_LATENCY_LOW;
+		else if (0 != strcmp(latency, "high"))
+			luaL_error(L, "Invalid latency: `%s' (must be a number, `low' or `high')", latency);
+	}
+	lua_pop(L, 1);
+}
+
+PaError player_open_stream(PaStream **stream, int nchannels, double samplerate,
+		const PlayerOptions *opts, PaStreamCallback *callback, void *udata)
+{
+	PaStreamParameters out;
+	out.device = paNoDevice == opts->device ? Pa_GetDefaultOutputDevice() : opts->device;
+
+	const PaDeviceInfo *info = Pa_GetDeviceInfo(out.device);
+	if (NULL == info)
+		return paInvalidDevice;
+
+	out.channelCount              = nchannels;
+	out.sampleFormat              = paFloat32;
+	out.hostApiSpecificStreamInfo = NULL;
+	if (PLAYER_LATENCY_LOW == opts->latency)
+		out.suggestedLatency = info->defaultLowOutputLatency;
+	else if (PLAYER_LATENCY_HIGH == opts->latency)
+		out.suggestedLatency = info->defaultHighOutputLatency;
+	else
+		out.suggestedLatency = opts->latency;
+
+	return Pa_OpenStream(stream, NULL, &out, samplerate, opts->frames,
+			paNoFlag, callback, udata);
+}
+
+static int player_render(PlayerInstance *pi, float *out, unsigned long frames,
+		const PaStreamCallbackTimeInfo *timeinfo)
+{
+	/* commands take effect at block boundaries */
+	player_drain_commands(pi);
+	player_publish(pi, pi->sample_pos, frames, timeinfo->outputBufferDacTime);
+
+	/* ramp to the new gain over one block to avoid zipper noise */
+	float gain  = pi->gain;
+	float dgain = (pi->target_gain - gain) / (float)frames;
 
 	float *in  = pi->buffer + (pi->sample_pos * pi->nchannels);
-	float *out = (float*)outputBuffer;
 
 	int i, c;
 	for (i = 0; i < (int)frames; ++i, ++pi->sample_pos)
 	{
-		if (pi->sample_pos > pi->nsamples)
+		if (pi->sample_pos >= pi->nsamples)
 		{
-			if (pi->is_looping)
+			unsigned int read = pi->blk_read;
+			if (read != atomic_get(&pi->blk_write))
+			{
+				/* continue gaplessly with the next queued buffer */
+				PlayerBlock *block = &pi->blocks[read % PLAYER_MAXQUEUED];
+				pi->buffer     = block->buffer;
+				pi->nsamples   = block->nsamples;
+				pi->sample_pos = 0;
+				in = pi->buffer;
+				atomic_set(&pi->blk_read, read + 1);
+			}
+			else if (pi->is_looping && pi->nsamples > 0)
 			{
 				pi->sample_pos = 0;
 				in = pi->buffer;
 			}
+			else if (atomic_get(&pi->fed) && !atomic_get(&pi->finished))
+			{
+				/* the next block is late: fill in silence and pick it up
+				 * in the next callback */
+				memset(out, 0, (frames - i) * pi->nchannels * sizeof(float));
+				pi->gain = pi->target_gain;
+				atomic_add(&pi->underruns, 1);
+				return paContinue;
+			}
 			else
+			{
+				memset(out, 0, (frames - i) * pi->nchannels * sizeof(float));
+				pi->gain = pi->target_gain;
+				player_publish(pi, pi->nsamples, 0, timeinfo->outputBufferDacTime);
 				return paComplete;
+			}
 		}
 
+		gain += dgain;
 		for (c = 0; c < pi->nchannels; ++c)
-			*out++ = *in++;
+			*out++ = gain * *in++;
 	}
 
+	pi->gain = pi->target_gain;
 	return paContinue;
 }
+
+static int pa_stream_callback(const void* inputBuffer, void* outputBuffer,
+		unsigned long frames, const PaStreamCallbackTimeInfo* timeinfo,
+		PaStreamCallbackFlags status, void* udata)
+{
+	(void)inputBuffer;
+
+	double start       = hres_time();
+	PlayerInstance* pi = (PlayerInstance*)udata;
+	int result = player_render(pi, (float*)outputBuffer, frames, timeinfo);
+	player_stats_record(&pi->stats, status, start);
+	return result;
+}
+
 PlayerInstance *lhc_checkplayer(lua_State* L, int idx)
 {
 	return (PlayerInstance *)luaL_checkudata(L, idx, INTERNAL_NAME);
 }
 
+/* sends a command to the audio thread. While the stream is not running,
+ * the callback cannot race us, so the command is applied right away. */
+static void player_send(lua_State *L, PlayerInstance *pi, int type, double value)
+{
+	PlayerCommand cmd = {type, value};
+
+	if (NULL == pi->stream || 1 != Pa_IsStreamActive(pi->stream))
+	{
+		player_drain_commands(pi);
+		player_apply(pi, &cmd);
+		pi->gain = pi->target_gain;
+		player_publish(pi, pi->sample_pos, 0, 0.);
+		return;
+	}
+
+	unsigned int write = pi->cmd_write;
+	for (int tries = 0; write - atomic_get(&pi->cmd_read) >= PLAYER_QUEUESIZE; ++tries)
+	{
+		if (tries > 100)
+			luaL_error(L, "Player does not respond");
+		hres_sleep(.001);
+	}
+
+	pi->commands[write % PLAYER_QUEUESIZE] = cmd;
+	atomic_set(&pi->cmd_write, write + 1);
+}
+
 static int lhc_player_seekTo(lua_State* L)
 {
 	PlayerInstance* pi = lhc_checkplayer(L, 1);
 	int pos = luaL_checkint(L, 2);
 
-	if (pos < 0 || pos > (int)pi->nsamples)
+	PlayerState st;
+	player_snapshot(pi, &st);
+	if (pos < 0 || pos > (int)st.nsamples)
 		return luaL_error(L, "Cannot seek to sample %d: out of bounds", pos);
-	pi->sample_pos = (size_t)pos;
+	player_send(L, pi, PLAYER_CMD_SEEK, pos);
 
 	lua_settop(L, 1);
 	return 1;
 }
 
+/* player:tell() -- current frame and time in seconds */
+static int lhc_player_tell(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	PlayerState st;
+	player_snapshot(pi, &st);
+
+	/* st.time is when the last rendered block reaches the speakers, usually
+	 * in the future by the output latency: count back from there */
+	double pos = (double)st.pos;
+	if (st.frames > 0 && NULL != pi->stream && 1 == Pa_IsStreamActive(pi->stream))
+	{
+		double elapsed = (Pa_GetStreamTime(pi->stream) - st.time) * pi->samplerate;
+		if (elapsed > (double)st.frames)
+			elapsed = (double)st.frames;
+		pos += elapsed;
+	}
+
+	if (pos < 0.)
+		pos = st.is_looping && st.nsamples > 0 ? fmod(pos, (double)st.nsamples) + st.nsamples : 0.;
+	else if (pos > (double)st.nsamples)
+		pos = st.is_looping && st.nsamples > 0 ? fmod(pos, (double)st.nsamples) : (double)st.nsamples;
+
+	lua_pushinteger(L, (lua_Integer)pos);
+	lua_pushnumber(L, floor(pos) / pi->samplerate);
+	return 2;
+}
+
 static int lhc_player_seek(lua_State* L)
 {
-	PlayerInstance* pi = lhc_checkplayer(L, 1);
+	lhc_checkplayer(L, 1);
 	int delta = luaL_checkint(L, 2);
 
-	lua_pushinteger(L, pi->sample_pos + delta);
+	/* seek relative to what is being heard, not to the last block */
+	lua_settop(L, 1);
+	lhc_player_tell(L);
+	lua_pushinteger(L, lua_tointeger(L, 2) + delta);
 	lua_replace(L, 2);
+	lua_settop(L, 2);
 	return lhc_player_seekTo(L);
 }
 
+/* player:gain([g]) -- set the gain, ramped over one block. Returns the gain. */
+static int lhc_player_gain(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	if (!lua_isnoneornil(L, 2))
+		player_send(L, pi, PLAYER_CMD_GAIN, luaL_checknumber(L, 2));
+
+	PlayerState st;
+	player_snapshot(pi, &st);
+	lua_pushnumber(L, lua_isnoneornil(L, 2) ? st.gain : luaL_checknumber(L, 2));
+	return 1;
+}
+
+/* player:loop([flag]) -- enable or disable looping. Returns the flag. */
+static int lhc_player_loop(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	if (!lua_isnoneornil(L, 2))
+		player_send(L, pi, PLAYER_CMD_LOOP, lua_toboolean(L, 2));
+
+	PlayerState st;
+	player_snapshot(pi, &st);
+	lua_pushboolean(L, lua_isnoneornil(L, 2) ? st.is_looping : lua_toboolean(L, 2));
+	return 1;
+}
+
+/* drops references to queued buffers the callback is done with */
+static void player_release(lua_State *L, PlayerInstance *pi, int idx)
+{
+	unsigned int read = atomic_get(&pi->blk_read);
+
+	lua_getfenv(L, idx);
+	for (; pi->blk_released + 1 < read; ++pi->blk_released)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, -2, (int)pi->blk_released + 1);
+	}
+	lua_pop(L, 1);
+}
+
+static int player_queued(PlayerInstance *pi)
+{
+	return (int)(pi->blk_write - atomic_get(&pi->blk_read));
+}
+
+/* player:queue(buffer [, wait]) -- play buffer after the current one.
+ * Blocks while the queue is full, unless wait is false, in which case
+ * false is returned. Otherwise returns the number of queued buffers.
+ * player:queue(nil) marks the end of the input: the player completes
+ * when the queue runs empty instead of waiting for more. */
+static int lhc_player_queue(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	if (lua_isnoneornil(L, 2))
+	{
+		atomic_set(&pi->finished, 1);
+		lua_pushinteger(L, player_queued(pi));
+		return 1;
+	}
+
+	float *buffer      = lhc_checkbuffer(L, 2);
+	size_t nsamples    = lhc_buffer_nsamples(L, 2);
+	int wait           = lua_isnoneornil(L, 3) || lua_toboolean(L, 3);
+
+	if (0 == nsamples || nsamples % pi->nchannels != 0)
+		return luaL_argerror(L, 2, "buffer size mismatches number of channels");
+
+	while (player_queued(pi) >= PLAYER_MAXQUEUED)
+	{
+		if (!wait)
+		{
+			lua_pushboolean(L, 0);
+			return 1;
+		}
+		if (1 != Pa_IsStreamActive(pi->stream))
+			return luaL_error(L, "Player queue is full, but the player is not playing");
+		hres_sleep(.001);
+	}
+	player_release(L, pi, 1);
+
+	/* fenv[n] = buffer, until the callback moved past it */
+	unsigned int write = pi->blk_write;
+	lua_getfenv(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, (int)write + 1);
+	lua_pop(L, 1);
+
+	pi->blocks[write % PLAYER_MAXQUEUED].buffer   = buffer;
+	pi->blocks[write % PLAYER_MAXQUEUED].nsamples = nsamples / pi->nchannels;
+	atomic_set(&pi->blk_write, write + 1);
+	atomic_set(&pi->finished, 0);
+	atomic_set(&pi->fed, 1);
+
+	lua_pushinteger(L, player_queued(pi));
+	return 1;
+}
+
+/* player:queued() -- number of buffers waiting to be played */
+static int lhc_player_queued(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	player_release(L, pi, 1);
+	lua_pushinteger(L, player_queued(pi));
+	return 1;
+}
+
+/* player:wait([n]) -- blocks until at most n buffers (default 0) are queued,
+ * so that the next block can be rendered in time */
+static int lhc_player_wait(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	int low            = luaL_optint(L, 2, 0);
+
+	while (player_queued(pi) > low && 1 == Pa_IsStreamActive(pi->stream))
+		hres_sleep(.001);
+
+	player_release(L, pi, 1);
+	lua_pushinteger(L, player_queued(pi));
+	return 1;
+}
+
+/* player:underruns() -- number of blocks that found the queue empty */
+static int lhc_player_underruns(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	lua_pushinteger(L, atomic_get(&pi->underruns));
+	return 1;
+}
+
+/* player:stats() */
+static int lhc_player_instance_stats(lua_State *L)
+{
+	PlayerInstance *pi = lhc_checkplayer(L, 1);
+	return lhc_player_pushstats(L, &pi->stats, pi->stream);
+}
+
 int lhc_player_play(lua_State* L)
 {
 	PlayerInstance* pi = lhc_checkplayer(L, 1);
 	if (NULL == pi->stream)
 		return luaL_error(L, "Stream not properly initialized.");
 
+	/* a stream that played to its end must be stopped before restarting */
+	if (1 == Pa_IsStreamActive(pi->stream))
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+	if (0 == Pa_IsStreamStopped(pi->stream))
+		Pa_StopStream(pi->stream);
+
 	PaError err = Pa_StartStream(pi->stream);
 	if (err != paNoError)
 		return luaL_error(L, "Cannot play stream: %s", Pa_GetErrorText(err));
@@ -168,16 +688,18 @@ int lhc_player_new(lua_State* L)
 	size_t nsamples   = lhc_buffer_nsamples(L, 1);
 	double samplerate = luaL_optnumber(L, 2, 44100);
 	int    nchannels  = luaL_optint(L, 3, 1);
-	int    is_looping = lua_toboolean(L, 4);
+
+	PlayerOptions opts;
+	player_checkoptions(L, 4, &opts);
 
 	if (nsamples % nchannels != 0)
 		return luaL_error(L, "Buffer size mismatches number of requested channels");
 
 	PlayerInstance *pi = lua_newuserdata(L, sizeof(PlayerInstance));
+	memset(pi, 0, sizeof(PlayerInstance));
 
-	PaError err = Pa_OpenDefaultStream(&pi->stream, 0, nchannels,
-			paFloat32, samplerate, paFramesPerBufferUnspecified,
-			pa_stream_callback, pi);
+	PaError err = player_open_stream(&pi->stream, nchannels, samplerate,
+			&opts, pa_stream_callback, pi);
 
 	if (err != paNoError)
 	{
@@ -185,11 +707,19 @@ int lhc_player_new(lua_State* L)
 		return luaL_error(L, "Cannot create player stream: %s\n", Pa_GetErrorText(err));
 	}
 
-	pi->nchannels  = nchannels;
-	pi->is_looping = is_looping;
-	pi->sample_pos = 0;
-	pi->nsamples   = nsamples / nchannels;
-	pi->buffer     = buffer;
+	pi->nchannels   = nchannels;
+	pi->samplerate  = samplerate;
+	pi->is_looping  = opts.is_looping;
+	pi->sample_pos  = 0;
+	pi->nsamples    = nsamples / nchannels;
+	pi->buffer      = buffer;
+	pi->gain        = 1.f;
+	pi->target_gain = 1.f;
+	player_publish(pi, 0, 0, 0.);
+
+	/* holds the buffers queued with player:queue() */
+	lua_newtable(L);
+	lua_setfenv(L, -2);
 
 	/* buffers[pi] = buffer */
 	luaL_getmetatable(L, BUFFERS_NAME);
@@ -212,6 +742,30 @@ int lhc_player_new(lua_State* L)
 		lua_pushcfunction(L, lhc_player_seek);
 		lua_setfield(L, -2, "seek");
 
+		lua_pushcfunction(L, lhc_player_tell);
+		lua_setfield(L, -2, "tell");
+
+		lua_pushcfunction(L, lhc_player_gain);
+		lua_setfield(L, -2, "gain");
+
+		lua_pushcfunction(L, lhc_player_loop);
+		lua_setfield(L, -2, "loop");
+
+		lua_pushcfunction(L, lhc_player_queue);
+		lua_setfield(L, -2, "queue");
+
+		lua_pushcfunction(L, lhc_player_queued);
+		lua_setfield(L, -2, "queued");
+
+		lua_pushcfunction(L, lhc_player_underruns);
+		lua_setfield(L, -2, "underruns");
+
+		lua_pushcfunction(L, lhc_player_wait);
+		lua_setfield(L, -2, "wait");
+
+		lua_pushcfunction(L, lhc_player_instance_stats);
+		lua_setfield(L, -2, "stats");
+
 		lua_pushcfunction(L, lhc_player_play);
 		lua_setfield(L, -2, "play");
 
@@ -230,6 +784,73 @@ int lhc_player_new(lua_State* L)
 }
 
 
+/* lhc.player.stats() -- totals over all players, and the engine's stats */
+static int lhc_player_stats(lua_State *L)
+{
+	lhc_player_pushstats(L, &player_stats_total, NULL);
+	lhc_engine_pushstats(L);
+	lua_setfield(L, -2, "engine");
+	return 1;
+}
+
+/* lhc.player.devices() -- list of all audio devices */
+static int lhc_player_devices(lua_State *L)
+{
+	PaDeviceIndex i, n = Pa_GetDeviceCount();
+	PaDeviceIndex default_output = Pa_GetDefaultOutputDevice();
+	if (n < 0)
+		return luaL_error(L, "Cannot list devices: %s", Pa_GetErrorText(n));
+
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; ++i)
+	{
+		const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+		if (NULL == info)
+			continue;
+		const PaHostApiInfo *api = Pa_GetHostApiInfo(info->hostApi);
+
+		lua_createtable(L, 0, 10);
+
+		lua_pushinteger(L, i);
+		lua_setfield(L, -2, "index");
+
+		lua_pushstring(L, info->name);
+		lua_setfield(L, -2, "name");
+
+		lua_pushstring(L, NULL != api ? api->name : "");
+		lua_setfield(L, -2, "hostapi");
+
+		lua_pushinteger(L, info->maxOutputChannels);
+		lua_setfield(L, -2, "outputs");
+
+		lua_pushinteger(L, info->maxInputChannels);
+		lua_setfield(L, -2, "inputs");
+
+		lua_pushnumber(L, info->defaultSampleRate);
+		lua_setfield(L, -2, "samplerate");
+
+		lua_pushnumber(L, info->defaultLowOutputLatency);
+		lua_setfield(L, -2, "low_latency");
+
+		lua_pushnumber(L, info->defaultHighOutputLatency);
+		lua_setfield(L, -2, "high_latency");
+
+		lua_pushboolean(L, i == default_output);
+		lua_setfield(L, -2, "default");
+
+		lua_rawseti(L, -2, (int)lua_objlen(L, -2) + 1);
+	}
+
+	return 1;
+}
+
+/* lhc.player(...) */
+static int lhc_player___call(lua_State *L)
+{
+	lua_remove(L, 1);
+	return lhc_player_new(L);
+}
+
 /* cleanup function of the dummy object created in luaopen_lhc_player */
 static int lhc_player_cleanup(lua_State* L)
 {
@@ -261,7 +882,33 @@ int luaopen_lhc_player(lua_State* L)
 	luaL_newmetatable(L, BUFFERS_NAME);
 	lua_pop(L, 1);
 
+	lua_createtable(L, 0, 8);
+
 	lua_pushcfunction(L, lhc_player_new);
+	lua_setfield(L, -2, "new");
+
+	lua_pushcfunction(L, lhc_player_stream);
+	lua_setfield(L, -2, "stream");
+
+	lua_pushcfunction(L, lhc_engine_halt);
+	lua_setfield(L, -2, "halt");
+
+	lua_pushcfunction(L, lhc_engine_voices);
+	lua_setfield(L, -2, "voices");
+
+	lua_pushcfunction(L, lhc_player_stats);
+	lua_setfield(L, -2, "stats");
+
+	lua_pushcfunction(L, lhc_player_devices);
+	lua_setfield(L, -2, "devices");
+
+	lua_pushcfunction(L, lhc_engine_configure);
+	lua_setfield(L, -2, "engine");
+
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lhc_player___call);
+	lua_setfield(L, -2, "__call");
+	lua_setmetatable(L, -2);
 
 	return 1;
 }
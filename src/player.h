@@ -35,13 +35,87 @@ extern "C" {
 #include <lua.h>
 #include <portaudio.h>
 
+#define PLAYER_QUEUESIZE 64
+#define PLAYER_MAXQUEUED 16
+#define PLAYER_HISTOGRAM 16
+
+enum { PLAYER_CMD_SEEK, PLAYER_CMD_GAIN, PLAYER_CMD_LOOP };
+
+typedef struct {
+	int    type;
+	double value;
+} PlayerCommand;
+
+typedef struct {
+	float  *buffer;
+	size_t  nsamples;
+} PlayerBlock;
+
+/* stream configuration from an options table */
+#define PLAYER_LATENCY_HIGH -1.
+#define PLAYER_LATENCY_LOW  -2.
+
+typedef struct {
+	PaDeviceIndex device;    /* paNoDevice: default output device */
+	unsigned long frames;    /* frames per buffer, 0: let PortAudio decide */
+	double        latency;   /* seconds, or PLAYER_LATENCY_LOW/HIGH */
+	int           is_looping;
+} PlayerOptions;
+
+/* callback statistics, updated by the audio thread with atomic adds */
+typedef struct {
+	unsigned int       callbacks;
+	unsigned int       underflows;
+	unsigned int       overflows;
+	unsigned int       max_usec;
+	unsigned long long total_usec;
+	/* bin k counts callbacks that took less than 2^k microseconds */
+	unsigned int       histogram[PLAYER_HISTOGRAM];
+} PlayerStats;
+
+/* written by the audio thread, read through the seqlock in `seq' */
+typedef struct {
+	unsigned int seq;
+	size_t       pos;      /* frame at the start of the last block */
+	size_t       frames;   /* length of the last block */
+	double       time;     /* stream time when the last block started */
+	size_t       nsamples; /* frames in the buffer being played */
+	float        gain;
+	int          is_looping;
+} PlayerState;
+
 typedef struct {
 	PaStream *stream;
 	int       nchannels;
-	int       is_looping;
-	size_t    sample_pos;
+	double    samplerate;
+
+	/* owned by the audio thread */
 	size_t    nsamples;
 	float    *buffer;
+	int       is_looping;
+	size_t    sample_pos;
+	float     gain;
+	float     target_gain;
+
+	/* single producer (Lua), single consumer (audio thread) */
+	PlayerCommand commands[PLAYER_QUEUESIZE];
+	unsigned int  cmd_read;
+	unsigned int  cmd_write;
+
+	/* buffers queued with player:queue(). The callback moves on to the
+	 * next one when the current buffer ends. Once a player is fed from
+	 * the queue, it plays silence while the queue is empty and only
+	 * completes after player:queue(nil) marked the end of the input. */
+	PlayerBlock   blocks[PLAYER_MAXQUEUED];
+	unsigned int  blk_read;
+	unsigned int  blk_write;
+	unsigned int  blk_released; /* Lua */
+	int           fed;          /* Lua */
+	int           finished;     /* Lua */
+	unsigned int  underruns;    /* blocks that found the queue empty */
+
+	PlayerState state;
+	PlayerStats stats;
 } PlayerInstance;
 
 int lua_isplayer(lua_State *L, int idx);
@@ -50,6 +124,19 @@ int lhc_player_new(lua_State* L);
 int lhc_player_play(lua_State *L);
 int luaopen_lhc_player(lua_State* L);
 
+/* reads looping flag or {loop=, device=, hostapi=, framesPerBuffer=, latency=}
+ * at idx. Raises an error for unknown devices. */
+void player_checkoptions(lua_State *L, int idx, PlayerOptions *opts);
+PaError player_open_stream(PaStream **stream, int nchannels, double samplerate,
+		const PlayerOptions *opts, PaStreamCallback *callback, void *udata);
+
+/* to be called by stream callbacks before returning. Also counts into
+ * the totals reported by lhc.player.stats(). */
+void player_stats_record(PlayerStats *stats, PaStreamCallbackFlags status, double start);
+/* pushes a table with the counters and, if given, the stream's cpu load
+ * and latency */
+int lhc_player_pushstats(lua_State *L, PlayerStats *stats, PaStream *stream);
+
 #ifdef __cplusplus
 }
 #endif
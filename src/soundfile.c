@@ -32,49 +32,192 @@
 
 #include <sndfile.h>
 #include <errno.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "soundfile.h"
 #include "buffer.h"
+#include "hash.h"
+#include "osfunc.h"
+#include "parallel.h"
+#include "pcm.h"
 
-static int get_format_enum(lua_State *L, const char *format_str, int bits)
+static int soundfile_major(lua_State *L, const char *format_str)
 {
-	int format;
 	if (0 == strcmp(format_str, "wav"))
-		format = SF_FORMAT_WAV;
+		return SF_FORMAT_WAV;
 	else if (0 == strcmp(format_str, "aiff"))
-		format = SF_FORMAT_AIFF;
+		return SF_FORMAT_AIFF;
 	else if (0 == strcmp(format_str, "au"))
-		format = SF_FORMAT_AU;
+		return SF_FORMAT_AU;
 	else if (0 == strcmp(format_str, "raw"))
-		format = SF_FORMAT_RAW;
+		return SF_FORMAT_RAW;
 	else if (0 == strcmp(format_str, "mat4"))
-		format = SF_FORMAT_MAT4;
+		return SF_FORMAT_MAT4;
 	else if (0 == strcmp(format_str, "mat5"))
-		format = SF_FORMAT_MAT5;
+		return SF_FORMAT_MAT5;
 	else if (0 == strcmp(format_str, "caf"))
-		format = SF_FORMAT_CAF;
+		return SF_FORMAT_CAF;
 	else if (0 == strcmp(format_str, "ogg"))
-		format = SF_FORMAT_OGG;
-	else
-		return luaL_error(L, "Unknown format: `%s'", format_str);
+		return SF_FORMAT_OGG;
+	else if (0 == strcmp(format_str, "flac"))
+		return SF_FORMAT_FLAC;
+
+	return luaL_error(L, "Unknown format: `%s'", format_str);
+}
+
+static const struct { const char *name; int subtype; } soundfile_subtypes[] = {
+	{"pcm8",   SF_FORMAT_PCM_S8},
+	{"pcm16",  SF_FORMAT_PCM_16},
+	{"pcm24",  SF_FORMAT_PCM_24},
+	{"pcm32",  SF_FORMAT_PCM_32},
+	{"u8",     SF_FORMAT_PCM_U8},
+	{"float",  SF_FORMAT_FLOAT},
+	{"double", SF_FORMAT_DOUBLE},
+	{"ulaw",   SF_FORMAT_ULAW},
+	{"alaw",   SF_FORMAT_ALAW},
+	{"vorbis", SF_FORMAT_VORBIS},
+	{NULL, 0}
+};
+
+static int soundfile_combine(lua_State *L, int major, int subtype)
+{
+	if (SF_FORMAT_OGG == major && SF_FORMAT_VORBIS != subtype)
+		return luaL_error(L, "ogg files can only hold vorbis data");
+	if (SF_FORMAT_VORBIS == subtype && SF_FORMAT_OGG != major)
+		return luaL_error(L, "vorbis data needs an ogg container");
+	if (SF_FORMAT_FLAC == major && SF_FORMAT_PCM_S8 != subtype
+			&& SF_FORMAT_PCM_16 != subtype && SF_FORMAT_PCM_24 != subtype)
+		return luaL_error(L, "flac supports 8, 16 and 24 bit integer samples only");
+
+	return major | subtype;
+}
+
+int lhc_soundfile_format(lua_State *L, const char *format_str, int bits)
+{
+	int major = soundfile_major(L, format_str);
+
+	/* ogg has no bit depth */
+	if (SF_FORMAT_OGG == major)
+		return major | SF_FORMAT_VORBIS;
 
 	switch (bits)
 	{
 		case 8:
-			format |= SF_FORMAT_PCM_S8; break;
+			return soundfile_combine(L, major, SF_FORMAT_PCM_S8);
 		case 16:
-			format |= SF_FORMAT_PCM_16; break;
+			return soundfile_combine(L, major, SF_FORMAT_PCM_16);
 		case 24:
-			format |= SF_FORMAT_PCM_24; break;
+			return soundfile_combine(L, major, SF_FORMAT_PCM_24);
 		case 32:
-			format |= SF_FORMAT_PCM_32; break;
+			return soundfile_combine(L, major, SF_FORMAT_PCM_32);
 		default:
 			return luaL_error(L, "Unsupported bit depth: %d.", bits);
 	}
+}
+
+int lhc_soundfile_checkformat(lua_State *L, const char *format_str, int idx)
+{
+	if (LUA_TSTRING != lua_type(L, idx))
+		return lhc_soundfile_format(L, format_str, luaL_optint(L, idx, 16));
+
+	const char *name = lua_tostring(L, idx);
+	for (int i = 0; NULL != soundfile_subtypes[i].name; ++i)
+		if (0 == strcmp(name, soundfile_subtypes[i].name))
+			return soundfile_combine(L, soundfile_major(L, format_str),
+					soundfile_subtypes[i].subtype);
+
+	return luaL_error(L, "Unknown sample format: `%s'", name);
+}
+
+void lhc_soundfile_checkoptions(lua_State *L, int idx, int format, SoundfileOptions *o)
+{
+	static const char *dither_modes[] = {"none", "tpdf", "shaped", NULL};
+	static const char *clip_modes[]   = {"hard", "soft", NULL};
+
+	o->compression = -1.;
+	o->dither      = PCM_DITHER_NONE;
+	o->clip        = PCM_CLIP_HARD;
+	o->seed        = (uint64_t)(hres_time() * 1e9);
+
+	if (lua_isnoneornil(L, idx))
+		return;
+
+	if (lua_isnumber(L, idx))
+		o->compression = lua_tonumber(L, idx);
+	else if (lua_istable(L, idx))
+	{
+		lua_getfield(L, idx, "compression");
+		lua_getfield(L, idx, "dither");
+		lua_getfield(L, idx, "clip");
+		lua_getfield(L, idx, "seed");
+		o->compression = luaL_optnumber(L, -4, -1.);
+		o->dither      = luaL_checkoption(L, -3, "none", dither_modes);
+		o->clip        = luaL_checkoption(L, -2, "hard", clip_modes);
+		if (!lua_isnil(L, -1))
+			o->seed = (uint64_t)luaL_checkinteger(L, -1);
+		lua_pop(L, 4);
+	}
+	else
+		luaL_typerror(L, idx, "number or table");
+
+	if (o->compression != -1. && (o->compression < 0. || o->compression > 1.))
+		luaL_argerror(L, idx, "compression level must be between 0 and 1");
+
+	int subtype = format & SF_FORMAT_SUBMASK;
+	if (PCM_DITHER_NONE != o->dither && SF_FORMAT_PCM_16 != subtype && SF_FORMAT_PCM_24 != subtype)
+		luaL_argerror(L, idx, "dither needs 16 or 24 bit output");
+}
+
+pcm_converter *lhc_soundfile_converter(const SF_INFO *info, const SoundfileOptions *o)
+{
+	switch (info->format & SF_FORMAT_SUBMASK)
+	{
+		case SF_FORMAT_PCM_16:
+			return pcm_converter_new(16, info->channels, o->dither, o->clip, o->seed);
+		case SF_FORMAT_PCM_24:
+			return pcm_converter_new(24, info->channels, o->dither, o->clip, o->seed);
+		default:
+			return NULL;
+	}
+}
+
+size_t lhc_soundfile_write_samples(SNDFILE *sf, pcm_converter *pcm, const float *buf, size_t len)
+{
+	if (NULL == pcm)
+		return sf_write_float(sf, buf, len);
+
+	union { short s[4096]; int i[4096]; } out;
+	size_t written = 0;
+	while (written < len)
+	{
+		size_t n = len - written < 4096 ? len - written : 4096;
+		sf_count_t k;
+		if (16 == pcm->bits)
+		{
+			pcm_convert_short(pcm, buf + written, out.s, n);
+			k = sf_write_short(sf, out.s, n);
+		}
+		else
+		{
+			pcm_convert_int(pcm, buf + written, out.i, n);
+			k = sf_write_int(sf, out.i, n);
+		}
+
+		written += k > 0 ? (size_t)k : 0;
+		if (k != (sf_count_t)n)
+			break;
+	}
+
+	return written;
+}
 
-	return format;
+void lhc_soundfile_set_compression(SNDFILE *sf, double level)
+{
+	if (level >= 0.)
+		sf_command(sf, SFC_SET_COMPRESSION_LEVEL, &level, sizeof(double));
 }
 
 typedef struct
@@ -82,6 +225,10 @@ typedef struct
 	void *data;
 	size_t len;
 	ptrdiff_t pos;
+	size_t capacity;
+	size_t mark;     /* bytes already handed out by an encoder */
+	size_t dirty_lo; /* range below mark that was rewritten since */
+	size_t dirty_hi;
 } vio_bufferinfo;
 
 static sf_count_t vio_get_filelen(void *ud)
@@ -103,7 +250,7 @@ static sf_count_t vio_seek(sf_count_t offset, int whence, void *ud)
 			info->pos = offset;
 			break;
 		case SEEK_END:
-			info->pos = info->len - offset;
+			info->pos = info->len + offset;
 			break;
 		default:
 			errno = EINVAL;
@@ -126,7 +273,7 @@ static sf_count_t vio_read(void *ptr, sf_count_t count, void *ud)
 	if (info->pos + count > (ptrdiff_t)info->len)
 		count = info->len - info->pos;
 
-	memcpy(ptr, info->data + info->pos, count);
+	memcpy(ptr, (const char *)info->data + info->pos, count);
 	info->pos += count;
 
 	return count;
@@ -136,16 +283,35 @@ static sf_count_t vio_write(const void *ptr, sf_count_t count, void *ud)
 {
 	vio_bufferinfo *info = (vio_bufferinfo *)ud;
 
-	size_t new_size = info->len + count;
-	info->data = realloc(info->data, new_size);
+	size_t end = info->pos + count;
+	if (end > info->capacity)
+	{
+		size_t capacity = info->capacity > 0 ? info->capacity : 4096;
+		while (capacity < end)
+			capacity *= 2;
 
-	if (NULL == info->data)
-		return 0;
+		void *data = realloc(info->data, capacity);
+		if (NULL == data)
+			return 0;
 
-	char *out = (char *)info->data + info->pos;
-	memcpy(out, ptr, count);
+		info->data     = data;
+		info->capacity = capacity;
+	}
+
+	if ((size_t)info->pos < info->mark)
+	{
+		size_t hi = end < info->mark ? end : info->mark;
+		if (info->dirty_hi == info->dirty_lo || (size_t)info->pos < info->dirty_lo)
+			info->dirty_lo = info->pos;
+		if (hi > info->dirty_hi)
+			info->dirty_hi = hi;
+	}
+
+	memcpy((char *)info->data + info->pos, ptr, count);
+	info->pos = end;
+	if (end > info->len)
+		info->len = end;
 
-	info->pos = info->len = new_size;
 	return count;
 }
 
@@ -185,11 +351,47 @@ static int lhc_soundfile_decode_common(lua_State *L, SNDFILE *sf, SF_INFO *info)
 	return 3;
 }
 
-static int lhc_soundfile_encode_common(lua_State *L, SNDFILE *sf, float *buf)
+/* decodes into dest at the 1-based sample offset at idx+1; returns number
+ * of samples written, sample rate and channels */
+static int lhc_soundfile_decodeinto_common(lua_State *L, SNDFILE *sf, SF_INFO *info, int idx)
+{
+	float *dest        = lhc_checkbuffer(L, idx);
+	size_t len         = lhc_buffer_nsamples(L, idx);
+	lua_Integer offset = luaL_optinteger(L, idx + 1, 1);
+	if (offset < 1 || (size_t)offset > len + 1)
+	{
+		sf_close(sf);
+		return luaL_argerror(L, idx + 1, "offset out of range");
+	}
+
+	size_t nframes = (len - (offset - 1)) / info->channels;
+	if (nframes > (size_t)info->frames)
+		nframes = info->frames;
+
+	sf_count_t read = sf_readf_float(sf, dest + offset - 1, nframes);
+	sf_close(sf);
+
+	if (read != (sf_count_t)nframes)
+		return luaL_error(L, "Error decoding: Requested to read %lu frames,"
+				"but read only %lu", nframes, (size_t)read);
+
+	lua_pushinteger(L, nframes * info->channels);
+	lua_pushinteger(L, info->samplerate);
+	lua_pushinteger(L, info->channels);
+
+	return 3;
+}
+
+static int lhc_soundfile_encode_common(lua_State *L, SNDFILE *sf, SF_INFO *info,
+		const SoundfileOptions *opts, float *buf)
 {
+	lhc_soundfile_set_compression(sf, opts->compression);
+	pcm_converter *pcm = lhc_soundfile_converter(info, opts);
+
 	size_t buf_len = lhc_buffer_nsamples(L, 1);
-	size_t written = sf_write_float(sf, buf, buf_len);
+	size_t written = lhc_soundfile_write_samples(sf, pcm, buf, buf_len);
 	sf_close(sf);
+	pcm_converter_free(pcm);
 
 	if (written != buf_len)
 		return luaL_error(L, "Error writing buffer: Requested to write %lu samples,"
@@ -204,8 +406,8 @@ static int lhc_soundfile_decode(lua_State *L)
 		return luaL_typerror(L, 1, "string");
 
 	vio_bufferinfo ud;
+	memset(&ud, 0, sizeof ud);
 	ud.data = (void *)lua_tolstring(L, 1, &ud.len);
-	ud.pos = 0;
 
 	SF_INFO info;
 	SNDFILE *sf = sf_open_virtual(&virtual_io, SFM_READ, &info, (void*)&ud);
@@ -216,28 +418,49 @@ static int lhc_soundfile_decode(lua_State *L)
 	return lhc_soundfile_decode_common(L, sf, &info);
 }
 
+/* lhc.soundfile.decodeinto(string, dest [, offset]) */
+static int lhc_soundfile_decodeinto(lua_State *L)
+{
+	if (!lua_isstring(L, 1))
+		return luaL_typerror(L, 1, "string");
+	lhc_checkbuffer(L, 2);
+
+	vio_bufferinfo ud;
+	memset(&ud, 0, sizeof ud);
+	ud.data = (void *)lua_tolstring(L, 1, &ud.len);
+
+	SF_INFO info;
+	memset(&info, 0, sizeof info);
+	SNDFILE *sf = sf_open_virtual(&virtual_io, SFM_READ, &info, (void*)&ud);
+	if (NULL == sf)
+		return luaL_error(L, "Cannot open context for decoding: %s",
+				sf_strerror(NULL));
+
+	return lhc_soundfile_decodeinto_common(L, sf, &info, 2);
+}
+
 static int lhc_soundfile_encode(lua_State *L)
 {
 	float *buf         = lhc_checkbuffer(L, 1);
 	const char *format = luaL_checkstring(L, 2);
 
 	vio_bufferinfo ud;
-	ud.data = NULL;
-	ud.len  = 0;
-	ud.pos  = 0;
+	memset(&ud, 0, sizeof ud);
 
 	SF_INFO info    = {0,0,0,0,0,0};
 	info.samplerate = luaL_optinteger(L, 3, 44100);
 	info.channels   = luaL_optinteger(L, 4, 1);
-	int bits        = luaL_optinteger(L, 5, 16);
-	info.format     = get_format_enum(L, format, bits);
+	info.format     = lhc_soundfile_checkformat(L, format, 5);
+
+	SoundfileOptions opts;
+	lhc_soundfile_checkoptions(L, 6, info.format, &opts);
 
 	SNDFILE *sf = sf_open_virtual(&virtual_io, SFM_WRITE, &info, (void*)&ud);
 	if (NULL == sf)
 		return luaL_error(L, "Cannot open context for encoding: %s",
 				sf_strerror(NULL));
 
-	(void)lhc_soundfile_encode_common(L, sf, buf);
+	(void)lhc_soundfile_encode_common(L, sf, &info, &opts, buf);
 
 	lua_pushlstring(L, (const char*)ud.data, ud.len);
 
@@ -247,17 +470,392 @@ static int lhc_soundfile_encode(lua_State *L)
 	return 1;
 }
 
+/*
+ * incremental in-memory encoding
+ */
+static const char *ENCODER_NAME = "lhc.soundfile.encoder";
+
+typedef struct
+{
+	SNDFILE *sf;
+	SF_INFO info;
+	pcm_converter *pcm;
+	vio_bufferinfo out;
+} Encoder;
+
+static Encoder *lhc_checkencoder(lua_State *L, int idx)
+{
+	Encoder *e = (Encoder *)luaL_checkudata(L, idx, ENCODER_NAME);
+	if (NULL == e->sf)
+		luaL_error(L, "Attempt to use a finished encoder");
+	return e;
+}
+
+/* pushes the encoded bytes that were not handed out yet */
+static void encoder_push_pending(lua_State *L, Encoder *e)
+{
+	lua_pushlstring(L, (const char *)e->out.data + e->out.mark, e->out.len - e->out.mark);
+	e->out.mark = e->out.len;
+}
+
+/* encoder:write(buffer) */
+static int lhc_soundfile_encoder_write(lua_State *L)
+{
+	Encoder *e = lhc_checkencoder(L, 1);
+	float *buf = lhc_checkbuffer(L, 2);
+	size_t len = lhc_buffer_nsamples(L, 2);
+
+	if (len % e->info.channels != 0)
+		return luaL_argerror(L, 2, "buffer size is not a multiple of the channel count");
+
+	size_t written = lhc_soundfile_write_samples(e->sf, e->pcm, buf, len);
+	if (written != len)
+		return luaL_error(L, "Error encoding buffer: Requested to write %lu samples,"
+				"but wrote only %lu", len, written);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* encoder:chunk() -- bytes produced since the last call */
+static int lhc_soundfile_encoder_chunk(lua_State *L)
+{
+	Encoder *e = lhc_checkencoder(L, 1);
+	encoder_push_pending(L, e);
+	return 1;
+}
+
+/* encoder:finish() -- remaining bytes. If earlier chunks were rewritten
+ * (e.g. the header of a wav file), also returns the corrected bytes and
+ * their 1-based position in the stream. */
+static int lhc_soundfile_encoder_finish(lua_State *L)
+{
+	Encoder *e = lhc_checkencoder(L, 1);
+	sf_close(e->sf);
+	e->sf = NULL;
+
+	encoder_push_pending(L, e);
+	if (e->out.dirty_hi == e->out.dirty_lo)
+		return 1;
+
+	lua_pushlstring(L, (const char *)e->out.data + e->out.dirty_lo,
+			e->out.dirty_hi - e->out.dirty_lo);
+	lua_pushinteger(L, e->out.dirty_lo + 1);
+	return 3;
+}
+
+static int lhc_soundfile_encoder___gc(lua_State *L)
+{
+	Encoder *e = (Encoder *)lua_touserdata(L, 1);
+	if (NULL != e->sf)
+		sf_close(e->sf);
+	e->sf = NULL;
+
+	pcm_converter_free(e->pcm);
+	e->pcm = NULL;
+
+	free(e->out.data);
+	e->out.data = NULL;
+	return 0;
+}
+
+/* lhc.soundfile.encoder(format [, rate, channels, bits, compression|options]) */
+static int lhc_soundfile_encoder(lua_State *L)
+{
+	const char *format = luaL_checkstring(L, 1);
+
+	Encoder *e = (Encoder *)lua_newuserdata(L, sizeof(Encoder));
+	memset(e, 0, sizeof(Encoder));
+	e->info.samplerate = luaL_optinteger(L, 2, 44100);
+	e->info.channels   = luaL_optinteger(L, 3, 1);
+	e->info.format     = lhc_soundfile_checkformat(L, format, 4);
+	luaL_argcheck(L, e->info.channels > 0, 3, "need at least one channel");
+
+	SoundfileOptions opts;
+	lhc_soundfile_checkoptions(L, 5, e->info.format, &opts);
+
+	if (luaL_newmetatable(L, ENCODER_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_soundfile_encoder___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_soundfile_encoder_write);
+		lua_setfield(L, -2, "write");
+
+		lua_pushcfunction(L, lhc_soundfile_encoder_chunk);
+		lua_setfield(L, -2, "chunk");
+
+		lua_pushcfunction(L, lhc_soundfile_encoder_finish);
+		lua_setfield(L, -2, "finish");
+	}
+	lua_setmetatable(L, -2);
+
+	e->sf = sf_open_virtual(&virtual_io, SFM_WRITE, &e->info, (void*)&e->out);
+	if (NULL == e->sf)
+		return luaL_error(L, "Cannot open context for encoding: %s",
+				sf_strerror(NULL));
+	lhc_soundfile_set_compression(e->sf, opts.compression);
+	e->pcm = lhc_soundfile_converter(&e->info, &opts);
+
+	return 1;
+}
+
+/*
+ * decoded file cache
+ */
+typedef struct CacheEntry
+{
+	struct CacheEntry *prev, *next;
+	struct CacheEntry *chain; /* next entry in the same bucket */
+	uint64_t hash;
+	char *path;
+	size_t filesize;
+	double mtime;
+	int samplerate;
+	int channels;
+	size_t nsamples;
+	float data[];
+} CacheEntry;
+
+/* entries are indexed by the hash of their path; the list keeps the
+ * most recently used entry first */
+static struct
+{
+	CacheEntry *head, *tail;
+	CacheEntry **buckets;
+	size_t nbuckets; /* power of two */
+	size_t budget; /* bytes, 0: disabled */
+	size_t used;
+	size_t entries;
+	unsigned long hits, misses;
+} file_cache;
+
+static size_t cache_entry_size(const CacheEntry *e)
+{
+	return sizeof(CacheEntry) + e->nsamples * sizeof(float) + strlen(e->path) + 1;
+}
+
+static void cache_unlink(CacheEntry *e)
+{
+	if (NULL != e->prev)
+		e->prev->next = e->next;
+	else
+		file_cache.head = e->next;
+
+	if (NULL != e->next)
+		e->next->prev = e->prev;
+	else
+		file_cache.tail = e->prev;
+
+	e->prev = e->next = NULL;
+}
+
+static void cache_push_front(CacheEntry *e)
+{
+	e->prev = NULL;
+	e->next = file_cache.head;
+	if (NULL != file_cache.head)
+		file_cache.head->prev = e;
+	file_cache.head = e;
+	if (NULL == file_cache.tail)
+		file_cache.tail = e;
+}
+
+static CacheEntry **cache_bucket(uint64_t hash)
+{
+	return &file_cache.buckets[hash & (file_cache.nbuckets - 1)];
+}
+
+/* keeps about one entry per bucket. If the table cannot grow, the old
+ * one stays in use with longer chains. */
+static int cache_reserve(size_t entries)
+{
+	if (entries <= file_cache.nbuckets)
+		return 1;
+
+	size_t n = file_cache.nbuckets > 0 ? file_cache.nbuckets * 2 : 64;
+	CacheEntry **buckets = calloc(n, sizeof(CacheEntry *));
+	if (NULL == buckets)
+		return file_cache.nbuckets > 0;
+
+	for (CacheEntry *e = file_cache.head; NULL != e; e = e->next)
+	{
+		e->chain = buckets[e->hash & (n - 1)];
+		buckets[e->hash & (n - 1)] = e;
+	}
+
+	free(file_cache.buckets);
+	file_cache.buckets  = buckets;
+	file_cache.nbuckets = n;
+	return 1;
+}
+
+static void cache_remove(CacheEntry *e)
+{
+	CacheEntry **p = cache_bucket(e->hash);
+	while (*p != e)
+		p = &(*p)->chain;
+	*p = e->chain;
+
+	cache_unlink(e);
+	file_cache.used -= cache_entry_size(e);
+	file_cache.entries--;
+	free(e->path);
+	free(e);
+}
+
+static void cache_trim(size_t budget)
+{
+	while (NULL != file_cache.tail && file_cache.used > budget)
+		cache_remove(file_cache.tail);
+}
+
+/* entry for path, if the file did not change since it was cached */
+static CacheEntry *cache_find(const char *path, uint64_t hash, size_t filesize, double mtime)
+{
+	if (0 == file_cache.nbuckets)
+		return NULL;
+
+	for (CacheEntry *e = *cache_bucket(hash); NULL != e; e = e->chain)
+	{
+		if (e->hash != hash || 0 != strcmp(e->path, path))
+			continue;
+
+		if (e->filesize != filesize || e->mtime != mtime)
+		{
+			cache_remove(e);
+			return NULL;
+		}
+
+		cache_unlink(e);
+		cache_push_front(e);
+		return e;
+	}
+	return NULL;
+}
+
+static void cache_insert(const char *path, uint64_t hash, size_t filesize, double mtime,
+		const SF_INFO *info, const float *data, size_t nsamples)
+{
+	size_t size = sizeof(CacheEntry) + nsamples * sizeof(float) + strlen(path) + 1;
+	if (size > file_cache.budget)
+		return;
+
+	CacheEntry *e = malloc(sizeof(CacheEntry) + nsamples * sizeof(float));
+	if (NULL == e)
+		return;
+	e->path = malloc(strlen(path) + 1);
+	if (NULL == e->path)
+	{
+		free(e);
+		return;
+	}
+
+	strcpy(e->path, path);
+	e->hash       = hash;
+	e->filesize   = filesize;
+	e->mtime      = mtime;
+	e->samplerate = info->samplerate;
+	e->channels   = info->channels;
+	e->nsamples   = nsamples;
+	memcpy(e->data, data, nsamples * sizeof(float));
+
+	cache_trim(file_cache.budget - size);
+	if (!cache_reserve(file_cache.entries + 1))
+	{
+		free(e->path);
+		free(e);
+		return;
+	}
+
+	CacheEntry **bucket = cache_bucket(hash);
+	e->chain = *bucket;
+	*bucket  = e;
+	cache_push_front(e);
+	file_cache.used += size;
+	file_cache.entries++;
+}
+
+/* lhc.soundfile.cache([budget]) -- set the memory budget of the decoded
+ * file cache in bytes (0 disables it). Returns bytes used, budget,
+ * number of entries, hits and misses. */
+static int lhc_soundfile_cache(lua_State *L)
+{
+	if (!lua_isnoneornil(L, 1))
+	{
+		lua_Number budget = luaL_checknumber(L, 1);
+		luaL_argcheck(L, budget >= 0, 1, "budget must not be negative");
+		file_cache.budget = (size_t)budget;
+		cache_trim(file_cache.budget);
+	}
+
+	lua_pushnumber(L, file_cache.used);
+	lua_pushnumber(L, file_cache.budget);
+	lua_pushinteger(L, file_cache.entries);
+	lua_pushinteger(L, file_cache.hits);
+	lua_pushinteger(L, file_cache.misses);
+	return 5;
+}
+
 static int lhc_soundfile_read(lua_State *L)
 {
 	const char *path = luaL_checkstring(L, 1);
 
+	/* cache hits are copied, buffers are mutable */
+	size_t filesize = 0;
+	double mtime    = 0.;
+	uint64_t hash   = 0;
+	int cached      = file_cache.budget > 0 && file_stat(path, &mtime, &filesize);
+	if (cached)
+	{
+		hash = lhc_hash64(path, strlen(path), 0);
+		CacheEntry *e = cache_find(path, hash, filesize, mtime);
+		if (NULL != e)
+		{
+			file_cache.hits++;
+			lua_pushcfunction(L, lhc_buffer_new);
+			lua_pushinteger(L, e->nsamples);
+			lua_call(L, 1, 1);
+			memcpy(lua_touserdata(L, -1), e->data, e->nsamples * sizeof(float));
+			lua_pushinteger(L, e->samplerate);
+			lua_pushinteger(L, e->channels);
+			return 3;
+		}
+		file_cache.misses++;
+	}
+
 	SF_INFO info;
+	memset(&info, 0, sizeof info);
 	SNDFILE *sf = sf_open(path, SFM_READ, &info);
 	if (NULL == sf)
 		return luaL_error(L, "Cannot open `%s' for reading: %s",
 				path, sf_strerror(NULL));
 
-	return lhc_soundfile_decode_common(L, sf, &info);
+	int n = lhc_soundfile_decode_common(L, sf, &info);
+	if (cached)
+		cache_insert(path, hash, filesize, mtime, &info,
+				(const float *)lua_touserdata(L, -3), lhc_buffer_nsamples(L, -3));
+
+	return n;
+}
+
+/* lhc.soundfile.readinto(path, dest [, offset]) */
+static int lhc_soundfile_readinto(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	lhc_checkbuffer(L, 2);
+
+	SF_INFO info;
+	memset(&info, 0, sizeof info);
+	SNDFILE *sf = sf_open(path, SFM_READ, &info);
+	if (NULL == sf)
+		return luaL_error(L, "Cannot open `%s' for reading: %s",
+				path, sf_strerror(NULL));
+
+	return lhc_soundfile_decodeinto_common(L, sf, &info, 2);
 }
 
 static int lhc_soundfile_write(lua_State *L)
@@ -268,20 +866,881 @@ static int lhc_soundfile_write(lua_State *L)
 	SF_INFO info    = {0,0,0,0,0,0};
 	info.samplerate = luaL_optinteger(L, 3, 44100);
 	info.channels   = luaL_optinteger(L, 4, 1);
-	int bits        = luaL_optinteger(L, 5, 16);
-	info.format     = get_format_enum(L, strrchr(path, '.') + 1, bits);
+	const char *ext = strrchr(path, '.');
+	if (NULL == ext)
+		return luaL_argerror(L, 2, "cannot determine file format");
+	info.format     = lhc_soundfile_checkformat(L, ext + 1, 5);
+
+	SoundfileOptions opts;
+	lhc_soundfile_checkoptions(L, 6, info.format, &opts);
 
 	SNDFILE *sf = sf_open(path, SFM_WRITE, &info);
 	if (NULL == sf)
 		return luaL_error(L, "Cannot open `%s' for writing: %s",
 				path, sf_strerror(NULL));
 
-	return lhc_soundfile_encode_common(L, sf, buf);
+	return lhc_soundfile_encode_common(L, sf, &info, &opts, buf);
 }
 
-int luaopen_lhc_soundfile(lua_State* L)
+/*
+ * streaming access
+ */
+static const char *INTERNAL_NAME = "lhc.soundfile.file";
+
+#define SOUNDFILE_MAXQUEUED (1 << 22)
+
+/* blocks waiting for the encoder thread of a writer */
+typedef struct SoundFileBlock
+{
+	struct SoundFileBlock *next;
+	size_t len;
+	float data[];
+} SoundFileBlock;
+
+typedef struct
+{
+	SNDFILE *sf;
+	SF_INFO info;
+	int mode;
+	SoundfileOptions opts;
+	pcm_converter *pcm;
+
+	/* writers encode on their own thread */
+	os_thread *thread;
+	os_mutex *lock;
+	os_cond *cond;
+	SoundFileBlock *head, *tail;
+	size_t pending; /* samples queued or being encoded */
+	int stop;
+	int failed;
+	char error[256];
+} SoundFile;
+
+static SoundFile *lhc_checksoundfile(lua_State *L, int idx)
+{
+	SoundFile *f = (SoundFile *)luaL_checkudata(L, idx, INTERNAL_NAME);
+	if (NULL == f->sf)
+		luaL_error(L, "Attempt to use a closed soundfile");
+	return f;
+}
+
+static SoundFile *lhc_checksoundfile_mode(lua_State *L, int idx, int mode)
+{
+	SoundFile *f = lhc_checksoundfile(L, idx);
+	if (f->mode != mode)
+		luaL_error(L, "Soundfile is not open for %s",
+				SFM_READ == mode ? "reading" : "writing");
+	return f;
+}
+
+static void *soundfile_encoder_thread(void *arg)
+{
+	SoundFile *f = (SoundFile *)arg;
+
+	mutex_lock(f->lock);
+	for (;;)
+	{
+		while (NULL == f->head && !f->stop)
+			cond_wait(f->cond, f->lock);
+		if (NULL == f->head)
+			break;
+
+		SoundFileBlock *block = f->head;
+		f->head = block->next;
+		if (NULL == f->head)
+			f->tail = NULL;
+		mutex_unlock(f->lock);
+
+		size_t written = f->failed ? 0 : lhc_soundfile_write_samples(f->sf, f->pcm, block->data, block->len);
+
+		mutex_lock(f->lock);
+		if (written != block->len && !f->failed)
+		{
+			snprintf(f->error, sizeof f->error, "Error writing buffer: Requested to write %lu samples,"
+					"but wrote only %lu", block->len, written);
+			f->failed = 1;
+		}
+		f->pending -= block->len;
+		free(block);
+		cond_broadcast(f->cond);
+	}
+	mutex_unlock(f->lock);
+
+	return NULL;
+}
+
+static int soundfile_start_encoder(SoundFile *f)
+{
+	f->lock = mutex_create();
+	f->cond = cond_create();
+	if (NULL != f->lock && NULL != f->cond)
+		f->thread = thread_create(soundfile_encoder_thread, f);
+	return NULL != f->thread;
+}
+
+/* waits until the encoder thread has written everything */
+static void soundfile_drain(SoundFile *f)
+{
+	if (NULL == f->thread)
+		return;
+
+	mutex_lock(f->lock);
+	while (f->pending > 0)
+		cond_wait(f->cond, f->lock);
+	mutex_unlock(f->lock);
+}
+
+static void soundfile_close(SoundFile *f)
+{
+	if (NULL != f->thread)
+	{
+		mutex_lock(f->lock);
+		f->stop = 1;
+		cond_broadcast(f->cond);
+		mutex_unlock(f->lock);
+		thread_join(f->thread);
+		f->thread = NULL;
+	}
+
+	if (NULL != f->lock)
+		mutex_destroy(f->lock);
+	if (NULL != f->cond)
+		cond_destroy(f->cond);
+	f->lock = NULL;
+	f->cond = NULL;
+
+	if (NULL != f->sf)
+		sf_close(f->sf);
+	f->sf = NULL;
+
+	pcm_converter_free(f->pcm);
+	f->pcm = NULL;
+}
+
+static void soundfile_checkfailed(lua_State *L, SoundFile *f)
+{
+	if (f->failed)
+		luaL_error(L, "%s", f->error);
+}
+
+/* file:write(buffer) -- append interleaved frames. The samples are copied
+ * and encoded on the writer's thread; errors surface on the next call. */
+static int lhc_soundfile_file_write(lua_State *L)
+{
+	SoundFile *f = lhc_checksoundfile_mode(L, 1, SFM_WRITE);
+	float *buf   = lhc_checkbuffer(L, 2);
+	size_t len   = lhc_buffer_nsamples(L, 2);
+
+	if (len % f->info.channels != 0)
+		return luaL_argerror(L, 2, "buffer size is not a multiple of the channel count");
+
+	soundfile_checkfailed(L, f);
+	if (0 == len)
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	SoundFileBlock *block = malloc(sizeof(SoundFileBlock) + len * sizeof(float));
+	if (NULL == block)
+		return luaL_error(L, "Out of memory");
+	block->next = NULL;
+	block->len  = len;
+	memcpy(block->data, buf, len * sizeof(float));
+
+	/* keep the amount of queued audio bounded */
+	mutex_lock(f->lock);
+	while (f->pending > 0 && f->pending + len > SOUNDFILE_MAXQUEUED)
+		cond_wait(f->cond, f->lock);
+
+	if (NULL == f->tail)
+		f->head = block;
+	else
+		f->tail->next = block;
+	f->tail = block;
+	f->pending += len;
+	cond_broadcast(f->cond);
+	mutex_unlock(f->lock);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_soundfile_file_flush(lua_State *L)
+{
+	SoundFile *f = lhc_checksoundfile_mode(L, 1, SFM_WRITE);
+	soundfile_drain(f);
+	soundfile_checkfailed(L, f);
+	sf_write_sync(f->sf);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_soundfile_file_close(lua_State *L)
+{
+	SoundFile *f = (SoundFile *)luaL_checkudata(L, 1, INTERNAL_NAME);
+	soundfile_close(f);
+	if (f->failed)
+	{
+		f->failed = 0;
+		return luaL_error(L, "%s", f->error);
+	}
+	return 0;
+}
+
+static int lhc_soundfile_file___gc(lua_State *L)
+{
+	soundfile_close((SoundFile *)lua_touserdata(L, 1));
+	return 0;
+}
+
+/* file:info() -- number of frames, sample rate and channels */
+static int lhc_soundfile_file_info(lua_State *L)
+{
+	SoundFile *f = lhc_checksoundfile(L, 1);
+	lua_pushinteger(L, f->info.frames);
+	lua_pushinteger(L, f->info.samplerate);
+	lua_pushinteger(L, f->info.channels);
+	return 3;
+}
+
+/* file:seek(frame) -- frame 0 is the start of the file */
+static int lhc_soundfile_file_seek(lua_State *L)
+{
+	SoundFile *f      = lhc_checksoundfile_mode(L, 1, SFM_READ);
+	lua_Integer frame = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, frame >= 0 && frame <= f->info.frames, 2, "frame out of range");
+
+	sf_count_t pos = sf_seek(f->sf, frame, SEEK_SET);
+	if (pos < 0)
+		return luaL_error(L, "Cannot seek: %s", sf_strerror(f->sf));
+
+	lua_pushinteger(L, pos);
+	return 1;
+}
+
+/* reads up to nframes into the buffer at idx, zeroing the rest */
+static size_t soundfile_read_frames(lua_State *L, SoundFile *f, int idx, size_t nframes)
+{
+	float *buf      = (float *)lua_touserdata(L, idx);
+	size_t len      = lhc_buffer_nsamples(L, idx);
+	size_t channels = f->info.channels;
+
+	if (nframes > len / channels)
+		nframes = len / channels;
+
+	sf_count_t got = sf_readf_float(f->sf, buf, nframes);
+	if (got < 0)
+		got = 0;
+
+	/* pad the requested frames only; the rest of buf is not ours */
+	memset(buf + got * channels, 0, (nframes - got) * channels * sizeof(float));
+	return (size_t)got;
+}
+
+/* file:read(nframes [, dest]) -- returns buffer and number of frames read */
+static int lhc_soundfile_file_read(lua_State *L)
+{
+	SoundFile *f        = lhc_checksoundfile_mode(L, 1, SFM_READ);
+	lua_Integer nframes = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, nframes >= 0, 2, "number of frames must not be negative");
+
+	if (lua_isnoneornil(L, 3))
+	{
+		sf_count_t left = f->info.frames - sf_seek(f->sf, 0, SEEK_CUR);
+		if (left < 0)
+			left = 0;
+		if (nframes > left)
+			nframes = left;
+
+		lua_pushcfunction(L, lhc_buffer_new);
+		lua_pushinteger(L, nframes * f->info.channels);
+		lua_call(L, 1, 1);
+	}
+	else
+	{
+		lhc_checkbuffer(L, 3);
+		lua_pushvalue(L, 3);
+	}
+
+	lua_pushinteger(L, soundfile_read_frames(L, f, -1, nframes));
+	return 2;
+}
+
+static int lhc_soundfile_file_frames_iter(lua_State *L)
+{
+	SoundFile *f     = lhc_checksoundfile_mode(L, lua_upvalueindex(1), SFM_READ);
+	size_t blocksize = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+
+	lua_pushvalue(L, lua_upvalueindex(2));
+	size_t got = soundfile_read_frames(L, f, -1, blocksize);
+	if (0 == got)
+		return 0;
+
+	lua_pushinteger(L, got);
+	return 2;
+}
+
+/* for block, n in file:frames(blocksize) do ... end
+ * the same buffer is reused for every block; the last one is zero padded */
+static int lhc_soundfile_file_frames(lua_State *L)
+{
+	SoundFile *f          = lhc_checksoundfile_mode(L, 1, SFM_READ);
+	lua_Integer blocksize = luaL_optinteger(L, 2, 4096);
+	luaL_argcheck(L, blocksize > 0, 2, "block size must be positive");
+
+	lua_settop(L, 1);
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, blocksize * f->info.channels);
+	lua_call(L, 1, 1);
+	lua_pushinteger(L, blocksize);
+	lua_pushcclosure(L, lhc_soundfile_file_frames_iter, 3);
+	return 1;
+}
+
+/* lhc.soundfile.open(path [, 'r']) or
+ * lhc.soundfile.open(path, 'w' [, rate, channels, bits, compression|options]) */
+static int lhc_soundfile_open(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	const char *mode = luaL_optstring(L, 2, "r");
+
+	SoundFile *f = (SoundFile *)lua_newuserdata(L, sizeof(SoundFile));
+	memset(f, 0, sizeof(SoundFile));
+
+	if (0 == strcmp(mode, "r"))
+		f->mode = SFM_READ;
+	else if (0 == strcmp(mode, "w"))
+	{
+		const char *ext = strrchr(path, '.');
+		if (NULL == ext)
+			return luaL_argerror(L, 1, "cannot determine file format");
+
+		f->mode            = SFM_WRITE;
+		f->info.samplerate = luaL_optinteger(L, 3, 44100);
+		f->info.channels   = luaL_optinteger(L, 4, 1);
+		f->info.format     = lhc_soundfile_checkformat(L, ext + 1, 5);
+		luaL_argcheck(L, f->info.channels > 0, 4, "need at least one channel");
+		lhc_soundfile_checkoptions(L, 6, f->info.format, &f->opts);
+	}
+	else
+		return luaL_error(L, "Unknown mode: `%s'", mode);
+
+	f->sf = sf_open(path, f->mode, &f->info);
+	if (NULL == f->sf)
+		return luaL_error(L, "Cannot open `%s' for %s: %s", path,
+				SFM_READ == f->mode ? "reading" : "writing", sf_strerror(NULL));
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_soundfile_file___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_soundfile_file_info);
+		lua_setfield(L, -2, "info");
+
+		lua_pushcfunction(L, lhc_soundfile_file_seek);
+		lua_setfield(L, -2, "seek");
+
+		lua_pushcfunction(L, lhc_soundfile_file_read);
+		lua_setfield(L, -2, "read");
+
+		lua_pushcfunction(L, lhc_soundfile_file_frames);
+		lua_setfield(L, -2, "frames");
+
+		lua_pushcfunction(L, lhc_soundfile_file_write);
+		lua_setfield(L, -2, "write");
+
+		lua_pushcfunction(L, lhc_soundfile_file_flush);
+		lua_setfield(L, -2, "flush");
+
+		lua_pushcfunction(L, lhc_soundfile_file_close);
+		lua_setfield(L, -2, "close");
+	}
+	lua_setmetatable(L, -2);
+
+	if (SFM_WRITE == f->mode)
+	{
+		lhc_soundfile_set_compression(f->sf, f->opts.compression);
+		f->pcm = lhc_soundfile_converter(&f->info, &f->opts);
+		if (!soundfile_start_encoder(f))
+			return luaL_error(L, "Cannot start encoder for `%s'", path);
+	}
+
+	return 1;
+}
+
+/*
+ * background loading
+ */
+static const char *FUTURE_NAME = "lhc.soundfile.future";
+
+typedef struct
+{
+	SNDFILE *sf;
+	SF_INFO info;
+	float *dest;
+	os_thread *thread;
+	int done;
+	int failed;
+	char error[256];
+} Future;
+
+static void *future_decode(void *arg)
+{
+	Future *f    = (Future *)arg;
+	size_t len   = f->info.frames * f->info.channels;
+	size_t read  = sf_read_float(f->sf, f->dest, len);
+	sf_close(f->sf);
+	f->sf = NULL;
+
+	if (read != len)
+	{
+		snprintf(f->error, sizeof f->error, "Error decoding: Requested to read %lu samples,"
+				"but read only %lu", len, read);
+		f->failed = 1;
+	}
+
+	atomic_set(&f->done, 1);
+	return NULL;
+}
+
+static void future_join(Future *f)
+{
+	if (NULL == f->thread)
+		return;
+	thread_join(f->thread);
+	f->thread = NULL;
+}
+
+/* future:ready() */
+static int lhc_soundfile_future_ready(lua_State *L)
+{
+	Future *f = (Future *)luaL_checkudata(L, 1, FUTURE_NAME);
+	lua_pushboolean(L, atomic_get(&f->done));
+	return 1;
+}
+
+/* future:wait() -- blocks until the file is decoded */
+static int lhc_soundfile_future_wait(lua_State *L)
+{
+	Future *f = (Future *)luaL_checkudata(L, 1, FUTURE_NAME);
+	future_join(f);
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* future:result() -- buffer, sample rate and channels, like soundfile.read */
+static int lhc_soundfile_future_result(lua_State *L)
+{
+	Future *f = (Future *)luaL_checkudata(L, 1, FUTURE_NAME);
+	future_join(f);
+
+	if (f->failed)
+		return luaL_error(L, "%s", f->error);
+
+	lua_getfenv(L, 1);
+	lua_rawgeti(L, -1, 1);
+	lua_pushinteger(L, f->info.samplerate);
+	lua_pushinteger(L, f->info.channels);
+	return 3;
+}
+
+static int lhc_soundfile_future___gc(lua_State *L)
+{
+	Future *f = (Future *)lua_touserdata(L, 1);
+	future_join(f);
+	if (NULL != f->sf)
+		sf_close(f->sf);
+	f->sf = NULL;
+	return 0;
+}
+
+/* lhc.soundfile.read_async(path) -- decodes on a background thread */
+static int lhc_soundfile_read_async(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+
+	Future *f = (Future *)lua_newuserdata(L, sizeof(Future));
+	memset(f, 0, sizeof(Future));
+
+	if (luaL_newmetatable(L, FUTURE_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_soundfile_future___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_soundfile_future_ready);
+		lua_setfield(L, -2, "ready");
+
+		lua_pushcfunction(L, lhc_soundfile_future_wait);
+		lua_setfield(L, -2, "wait");
+
+		lua_pushcfunction(L, lhc_soundfile_future_result);
+		lua_setfield(L, -2, "result");
+	}
+	lua_setmetatable(L, -2);
+
+	/* the header is read right away, so errors surface here */
+	f->sf = sf_open(path, SFM_READ, &f->info);
+	if (NULL == f->sf)
+		return luaL_error(L, "Cannot open `%s' for reading: %s",
+				path, sf_strerror(NULL));
+
+	/* the decoder writes directly into the buffer held by the future */
+	lua_createtable(L, 1, 0);
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, f->info.frames * f->info.channels);
+	lua_call(L, 1, 1);
+	f->dest = (float *)lua_touserdata(L, -1);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+
+	f->thread = thread_create(future_decode, f);
+	if (NULL == f->thread)
+		future_decode(f);
+
+	return 1;
+}
+
+/*
+ * batch processing
+ */
+typedef struct
+{
+	const char *input;
+	const char *output;
+	int format;
+	int rate;         /* 0: keep */
+	double gain;
+	double normalize; /* target peak, 0: off */
+	SoundfileOptions opts;
+	int failed;
+	char error[256];
+} BatchJob;
+
+/* windowed sinc resampling. The kernel is tabulated once per call and
+ * interpolated linearly between table entries; its cutoff is lowered to
+ * the output nyquist frequency when downsampling. */
+#define RESAMPLE_ZEROS 24  /* zero crossings on either side of the kernel */
+#define RESAMPLE_RES   256 /* table entries per zero crossing */
+#define RESAMPLE_BETA  8.6 /* kaiser window shape, about -90 dB stop band */
+#define RESAMPLE_PASS  .95 /* cutoff relative to the lower nyquist frequency */
+#define PI             3.141592653589793
+
+static double resample_bessel_i0(double x)
+{
+	double sum = 1., term = 1.;
+	for (int k = 1; k < 32; ++k)
+	{
+		term *= (x / (2. * k)) * (x / (2. * k));
+		sum  += term;
+	}
+	return sum;
+}
+
+static float *batch_resample(const float *in, size_t frames, int channels,
+		int from, int to, size_t *out_frames)
+{
+	size_t n     = (size_t)ceil((double)frames * to / from);
+	size_t len   = RESAMPLE_ZEROS * RESAMPLE_RES + 2;
+	float *out   = calloc(n * channels + 1, sizeof(float));
+	float *table = malloc(len * sizeof(float));
+	if (NULL == out || NULL == table)
+	{
+		free(out);
+		free(table);
+		return NULL;
+	}
+
+	double i0 = resample_bessel_i0(RESAMPLE_BETA);
+	for (size_t j = 0; j < len; ++j)
+	{
+		double x = (double)j / RESAMPLE_RES, r = x / RESAMPLE_ZEROS;
+		double w = r < 1. ? resample_bessel_i0(RESAMPLE_BETA * sqrt(1. - r * r)) / i0 : 0.;
+		table[j] = (float)(j > 0 ? w * sin(PI * x) / (PI * x) : 1.);
+	}
+
+	double step  = (double)from / to;
+	double fc    = (to < from ? (double)to / from : 1.) * RESAMPLE_PASS;
+	double width = RESAMPLE_ZEROS / fc; /* input frames on either side */
+	for (size_t i = 0; i < n; ++i)
+	{
+		double t  = i * step;
+		double k0 = ceil(t - width), k1 = floor(t + width);
+		size_t lo = k0 > 0. ? (size_t)k0 : 0;
+		size_t hi = k1 < (double)(frames - 1) ? (size_t)k1 : frames - 1;
+
+		float *o  = out + i * channels;
+		double wsum = 0.;
+		for (size_t k = lo; k <= hi; ++k)
+		{
+			double x = fabs(t - (double)k) * fc * RESAMPLE_RES;
+			size_t j = (size_t)x;
+			if (j + 1 >= len)
+				continue;
+			float w = table[j] + (float)(x - j) * (table[j+1] - table[j]);
+			wsum += w;
+			for (int c = 0; c < channels; ++c)
+				o[c] += w * in[k*channels + c];
+		}
+
+		/* unit gain at DC, also where the kernel is cut off at the ends */
+		if (wsum > 0.)
+			for (int c = 0; c < channels; ++c)
+				o[c] = (float)(o[c] / wsum);
+	}
+
+	free(table);
+	*out_frames = n;
+	return out;
+}
+
+static void batch_run(BatchJob *job)
+{
+	SF_INFO info;
+	memset(&info, 0, sizeof info);
+	SNDFILE *sf = sf_open(job->input, SFM_READ, &info);
+	if (NULL == sf)
+	{
+		snprintf(job->error, sizeof job->error, "Cannot open `%s' for reading: %s",
+				job->input, sf_strerror(NULL));
+		job->failed = 1;
+		return;
+	}
+
+	size_t frames = info.frames;
+	size_t len    = frames * info.channels;
+	float *data   = malloc(len * sizeof(float) + 1);
+	if (NULL == data)
+	{
+		sf_close(sf);
+		snprintf(job->error, sizeof job->error, "Out of memory decoding `%s'", job->input);
+		job->failed = 1;
+		return;
+	}
+
+	sf_count_t got = sf_readf_float(sf, data, frames);
+	if (got != (sf_count_t)frames)
+	{
+		snprintf(job->error, sizeof job->error, "Error reading `%s': got %lld of %lld frames",
+				job->input, (long long)(got > 0 ? got : 0), (long long)frames);
+		sf_close(sf);
+		free(data);
+		job->failed = 1;
+		return;
+	}
+	sf_close(sf);
+
+	double gain = job->gain;
+	if (job->normalize > 0.)
+	{
+		float peak = 0.f;
+		for (size_t i = 0; i < len; ++i)
+			peak = fmaxf(peak, fabsf(data[i]));
+		gain = peak > 0.f ? job->normalize / peak : 1.;
+	}
+	if (gain != 1.)
+		for (size_t i = 0; i < len; ++i)
+			data[i] *= (float)gain;
+
+	if (job->rate > 0 && job->rate != info.samplerate && frames > 0)
+	{
+		float *resampled = batch_resample(data, frames, info.channels,
+				info.samplerate, job->rate, &frames);
+		free(data);
+		if (NULL == resampled)
+		{
+			snprintf(job->error, sizeof job->error, "Out of memory resampling `%s'", job->input);
+			job->failed = 1;
+			return;
+		}
+		data = resampled;
+		info.samplerate = job->rate;
+	}
+
+	SF_INFO out;
+	memset(&out, 0, sizeof out);
+	out.samplerate = info.samplerate;
+	out.channels   = info.channels;
+	out.format     = job->format;
+
+	sf = sf_open(job->output, SFM_WRITE, &out);
+	if (NULL == sf)
+	{
+		free(data);
+		snprintf(job->error, sizeof job->error, "Cannot open `%s' for writing: %s",
+				job->output, sf_strerror(NULL));
+		job->failed = 1;
+		return;
+	}
+
+	lhc_soundfile_set_compression(sf, job->opts.compression);
+	pcm_converter *pcm = lhc_soundfile_converter(&out, &job->opts);
+	if (NULL == pcm)
+		sf_command(sf, SFC_SET_CLIPPING, NULL, SF_TRUE);
+
+	len = frames * out.channels;
+	if (lhc_soundfile_write_samples(sf, pcm, data, len) != len)
+	{
+		snprintf(job->error, sizeof job->error, "Error writing `%s': %s",
+				job->output, sf_strerror(sf));
+		job->failed = 1;
+	}
+
+	pcm_converter_free(pcm);
+	sf_close(sf);
+	free(data);
+}
+
+static void batch_worker(void *ud, size_t begin, size_t end)
+{
+	BatchJob *jobs = (BatchJob *)ud;
+	for (size_t i = begin; i < end; ++i)
+		batch_run(&jobs[i]);
+}
+
+/* option from the job table at idx, falling back to the options table */
+static double batch_opt(lua_State *L, int idx, const char *name, double def)
+{
+	lua_getfield(L, idx, name);
+	if (lua_isnil(L, -1) && lua_istable(L, 2))
+	{
+		lua_pop(L, 1);
+		lua_getfield(L, 2, name);
+	}
+	double value = lua_isnil(L, -1) ? def : lua_tonumber(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+/* encoder options from the job table at idx, falling back to the options table */
+static void batch_checkoptions(lua_State *L, int idx, int format, SoundfileOptions *o)
 {
+	static const char *names[] = {"compression", "dither", "clip", "seed", NULL};
+
 	lua_createtable(L, 0, 4);
+	for (const char **name = names; NULL != *name; ++name)
+	{
+		lua_getfield(L, idx, *name);
+		if (lua_isnil(L, -1) && lua_istable(L, 2))
+		{
+			lua_pop(L, 1);
+			lua_getfield(L, 2, *name);
+		}
+		lua_setfield(L, -2, *name);
+	}
+	lhc_soundfile_checkoptions(L, lua_gettop(L), format, o);
+	lua_pop(L, 1);
+}
+
+/* lhc.soundfile.batch(jobs [, opts])
+ *   jobs: list of {input = path, output = path
+ *                  [, gain, normalize, rate, bits, compression, dither, clip, seed]}
+ *   opts: defaults for the job fields, plus `threads' and `progress'
+ * returns a list with true or an error message for each job */
+static int lhc_soundfile_batch(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (!lua_isnoneornil(L, 2))
+		luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+
+	size_t n = lua_objlen(L, 1);
+	BatchJob *jobs = (BatchJob *)lua_newuserdata(L, n * sizeof(BatchJob) + 1);
+	memset(jobs, 0, n * sizeof(BatchJob));
+
+	/* the job tables keep the path strings alive */
+	for (size_t i = 0; i < n; ++i)
+	{
+		lua_rawgeti(L, 1, (int)i + 1);
+		if (!lua_istable(L, -1))
+			return luaL_error(L, "Job %d is not a table", (int)i + 1);
+		int idx = lua_gettop(L);
+
+		lua_getfield(L, idx, "input");
+		lua_getfield(L, idx, "output");
+		jobs[i].input  = lua_tostring(L, -2);
+		jobs[i].output = lua_tostring(L, -1);
+		if (NULL == jobs[i].input || NULL == jobs[i].output)
+			return luaL_error(L, "Job %d needs an input and an output path", (int)i + 1);
+		lua_pop(L, 2);
+
+		const char *ext = strrchr(jobs[i].output, '.');
+		if (NULL == ext)
+			return luaL_error(L, "Cannot determine file format of `%s'", jobs[i].output);
+
+		lua_getfield(L, idx, "bits");
+		if (lua_isnil(L, -1) && lua_istable(L, 2))
+		{
+			lua_pop(L, 1);
+			lua_getfield(L, 2, "bits");
+		}
+		jobs[i].format    = lhc_soundfile_checkformat(L, ext + 1, -1);
+		lua_pop(L, 1);
+		jobs[i].rate      = (int)batch_opt(L, idx, "rate", 0);
+		jobs[i].gain      = batch_opt(L, idx, "gain", 1);
+		jobs[i].normalize = batch_opt(L, idx, "normalize", 0);
+		batch_checkoptions(L, idx, jobs[i].format, &jobs[i].opts);
+		lua_pop(L, 1);
+	}
+
+	int nthreads = lua_istable(L, 2) ? (int)batch_opt(L, 2, "threads", 0) : 0;
+	int progress = 0;
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "progress");
+		progress = lua_isfunction(L, -1) ? lua_gettop(L) : 0;
+	}
+
+	parallel_task *task = parallel_start(n, 1, nthreads, batch_worker, jobs);
+	if (NULL == task)
+		batch_worker(jobs, 0, n);
+
+	/* report progress from this thread while the workers run */
+	size_t reported = 0, done = 0;
+	int status = 0;
+	while (NULL != task && done < n)
+	{
+		done = parallel_done(task);
+		if (done != reported && progress && 0 == status)
+		{
+			lua_pushvalue(L, progress);
+			lua_pushinteger(L, done);
+			lua_pushinteger(L, n);
+			status = lua_pcall(L, 2, 0, 0);
+			reported = done;
+		}
+		if (done < n)
+			hres_sleep(.01);
+	}
+
+	if (NULL != task)
+		parallel_wait(task);
+	if (0 != status)
+		return lua_error(L);
+
+	lua_createtable(L, n, 0);
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (jobs[i].failed)
+			lua_pushstring(L, jobs[i].error);
+		else
+			lua_pushboolean(L, 1);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+
+	return 1;
+}
+
+int luaopen_lhc_soundfile(lua_State* L)
+{
+	lua_createtable(L, 0, 11);
 
 	lua_pushcfunction(L, lhc_soundfile_decode);
 	lua_setfield(L, -2, "decode");
@@ -295,5 +1754,26 @@ int luaopen_lhc_soundfile(lua_State* L)
 	lua_pushcfunction(L, lhc_soundfile_write);
 	lua_setfield(L, -2, "write");
 
+	lua_pushcfunction(L, lhc_soundfile_read_async);
+	lua_setfield(L, -2, "read_async");
+
+	lua_pushcfunction(L, lhc_soundfile_decodeinto);
+	lua_setfield(L, -2, "decodeinto");
+
+	lua_pushcfunction(L, lhc_soundfile_cache);
+	lua_setfield(L, -2, "cache");
+
+	lua_pushcfunction(L, lhc_soundfile_batch);
+	lua_setfield(L, -2, "batch");
+
+	lua_pushcfunction(L, lhc_soundfile_encoder);
+	lua_setfield(L, -2, "encoder");
+
+	lua_pushcfunction(L, lhc_soundfile_readinto);
+	lua_setfield(L, -2, "readinto");
+
+	lua_pushcfunction(L, lhc_soundfile_open);
+	lua_setfield(L, -2, "open");
+
 	return 1;
 }
@@ -33,7 +33,29 @@ extern "C" {
 #endif
 
 #include <lua.h>
+#include <stdint.h>
+#include <sndfile.h>
+#include "pcm.h"
 
+typedef struct
+{
+	double compression; /* in [0,1] for flac and vorbis; -1 keeps the default */
+	int dither;
+	int clip;
+	uint64_t seed;
+} SoundfileOptions;
+
+int lhc_soundfile_format(lua_State *L, const char *format_str, int bits);
+/* bit depth or sample format name ("float", "pcm24", ...) at idx */
+int lhc_soundfile_checkformat(lua_State *L, const char *format_str, int idx);
+/* either a compression level or a table with the fields compression,
+ * dither ('none', 'tpdf', 'shaped'), clip ('hard', 'soft') and seed */
+void lhc_soundfile_checkoptions(lua_State *L, int idx, int format, SoundfileOptions *o);
+/* native float to integer conversion for 16 and 24 bit output, NULL otherwise */
+pcm_converter *lhc_soundfile_converter(const SF_INFO *info, const SoundfileOptions *o);
+/* writes through the converter if there is one */
+size_t lhc_soundfile_write_samples(SNDFILE *sf, pcm_converter *pcm, const float *buf, size_t len);
+void lhc_soundfile_set_compression(SNDFILE *sf, double level);
 int luaopen_lhc_soundfile(lua_State* L);
 
 #ifdef __cplusplus
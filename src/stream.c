@@ -0,0 +1,524 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <portaudio.h>
+#include <sndfile.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osfunc.h"
+#include "player.h"
+#include "stream.h"
+
+static const char *INTERNAL_NAME = "lhc.player.stream";
+
+#define STREAM_RINGFRAMES  (1 << 16)
+#define STREAM_CHUNKFRAMES 4096
+#define STREAM_MINFRAMES   256
+#define STREAM_PREFETCH    8192
+#define STREAM_NOEND       ((size_t)-1)
+
+typedef struct
+{
+	PaStream *stream;
+	SNDFILE  *sf;
+	SF_INFO   info;
+
+	/* interleaved samples. `read' and `write' count samples and only ever
+	 * grow, the position in the ring is taken modulo `capacity'. */
+	float  *ring;
+	size_t  capacity;
+	size_t  read;  /* advanced by the callback */
+	size_t  write; /* advanced by the decoder */
+	size_t  end;   /* value of `write' at the end of the file */
+
+	/* a seek is requested by Lua and carried out by the decoder, which
+	 * publishes where the new data starts through the seqlock `flush_seq'.
+	 * The callback then skips everything before `flush_at'. */
+	size_t       seek_frame;
+	unsigned int seek_request;
+	unsigned int seek_handled;
+	unsigned int flush_seq;
+	unsigned int flush_request;
+	size_t       flush_at;
+	size_t       flush_frame;
+	unsigned int flush_seen;    /* callback */
+	unsigned int seek_applied;  /* last request the callback acted on */
+
+	size_t       frame;         /* callback */
+	size_t       pos;
+	int          is_looping;
+	unsigned int underruns;
+	PlayerStats  stats;
+
+	os_thread *thread;
+	os_mutex  *lock;
+	os_cond   *cond;
+	int        stop;
+} StreamPlayer;
+
+static StreamPlayer *lhc_checkstream(lua_State *L, int idx)
+{
+	return (StreamPlayer *)luaL_checkudata(L, idx, INTERNAL_NAME);
+}
+
+/* switches to the data decoded after a seek. Until at least `want'
+ * samples of it are ready, what is left from before the seek keeps
+ * playing, so seeks do not cause a gap. Called from the callback, or by
+ * Lua while the stream is stopped. */
+static void stream_flush(StreamPlayer *sp, size_t want)
+{
+	unsigned int seq = atomic_get(&sp->flush_seq);
+	if (seq == sp->flush_seen || (seq & 1))
+		return;
+
+	size_t at        = sp->flush_at;
+	size_t frame     = sp->flush_frame;
+	unsigned int req = sp->flush_request;
+	atomic_fence();
+	if (seq != atomic_get(&sp->flush_seq))
+		return;
+
+	size_t ready = atomic_get(&sp->write) - at;
+	if (ready < want && sp->read < at && STREAM_NOEND == atomic_get(&sp->end))
+		return;
+
+	atomic_set(&sp->read, at);
+	sp->frame      = frame;
+	sp->flush_seen = seq;
+	atomic_set(&sp->seek_applied, req);
+}
+
+static int stream_render(StreamPlayer *sp, float *out, unsigned long frames)
+{
+	int channels = sp->info.channels;
+	size_t want  = frames * channels;
+
+	stream_flush(sp, want);
+
+	size_t read  = sp->read;
+	size_t avail = atomic_get(&sp->write) - read;
+	size_t n     = avail < want ? avail : want;
+
+	/* before a pending seek is applied, only old data may be played */
+	if (sp->flush_seen != atomic_get(&sp->flush_seq) && sp->flush_at - read < n)
+		n = sp->flush_at - read;
+
+	size_t offset = read % sp->capacity;
+	size_t first  = sp->capacity - offset < n ? sp->capacity - offset : n;
+	memcpy(out, sp->ring + offset, first * sizeof(float));
+	memcpy(out + first, sp->ring, (n - first) * sizeof(float));
+	atomic_set(&sp->read, read + n);
+
+	sp->frame += n / channels;
+	if (sp->frame >= (size_t)sp->info.frames && atomic_get(&sp->is_looping) && sp->info.frames > 0)
+		sp->frame %= sp->info.frames;
+	atomic_set(&sp->pos, sp->frame);
+
+	if (n < want)
+	{
+		memset(out + n, 0, (want - n) * sizeof(float));
+		if (read + n == atomic_get(&sp->end))
+			return paComplete;
+		atomic_add(&sp->underruns, 1);
+	}
+
+	return paContinue;
+}
+
+static int stream_callback(const void *inputBuffer, void *outputBuffer,
+		unsigned long frames, const PaStreamCallbackTimeInfo *timeinfo,
+		PaStreamCallbackFlags status, void *udata)
+{
+	(void)inputBuffer;
+	(void)timeinfo;
+
+	double start     = hres_time();
+	StreamPlayer *sp = (StreamPlayer *)udata;
+	int result = stream_render(sp, (float *)outputBuffer, frames);
+	player_stats_record(&sp->stats, status, start);
+	return result;
+}
+
+/* decoder thread: keeps the ring filled and carries out seeks */
+static void *stream_decode(void *arg)
+{
+	StreamPlayer *sp = (StreamPlayer *)arg;
+	int channels     = sp->info.channels;
+	int at_end       = 0;
+
+	mutex_lock(sp->lock);
+	while (!sp->stop)
+	{
+		if (sp->seek_request != sp->seek_handled)
+		{
+			unsigned int request = sp->seek_request;
+			size_t frame = sp->seek_frame;
+			mutex_unlock(sp->lock);
+
+			sf_seek(sp->sf, frame, SEEK_SET);
+			at_end = 0;
+			atomic_set(&sp->end, STREAM_NOEND);
+
+			atomic_add(&sp->flush_seq, 1);
+			atomic_fence();
+			sp->flush_at      = sp->write;
+			sp->flush_frame   = frame;
+			sp->flush_request = request;
+			atomic_fence();
+			atomic_add(&sp->flush_seq, 1);
+
+			mutex_lock(sp->lock);
+			atomic_set(&sp->seek_handled, request);
+			continue;
+		}
+
+		if (at_end && sp->is_looping && sp->info.frames > 0)
+		{
+			sf_seek(sp->sf, 0, SEEK_SET);
+			at_end = 0;
+			atomic_set(&sp->end, STREAM_NOEND);
+		}
+
+		/* a full ring is topped up in small pieces, so that data after a
+		 * seek is available soon, while the callback plays the old data */
+		size_t free_frames = (sp->capacity - (sp->write - atomic_get(&sp->read))) / channels;
+		if (at_end || free_frames < STREAM_MINFRAMES)
+		{
+			/* the callback cannot signal us, so poll for free space */
+			cond_timedwait(sp->cond, sp->lock, .002);
+			continue;
+		}
+		mutex_unlock(sp->lock);
+
+		size_t offset = sp->write % sp->capacity;
+		size_t frames = (sp->capacity - offset) / channels;
+		if (frames > free_frames)
+			frames = free_frames;
+		if (frames > STREAM_CHUNKFRAMES)
+			frames = STREAM_CHUNKFRAMES;
+
+		sf_count_t n = sf_readf_float(sp->sf, sp->ring + offset, frames);
+		if (n > 0)
+			atomic_set(&sp->write, sp->write + (size_t)n * channels);
+		else
+		{
+			at_end = 1;
+			atomic_set(&sp->end, sp->write);
+		}
+
+		mutex_lock(sp->lock);
+	}
+	mutex_unlock(sp->lock);
+
+	return NULL;
+}
+
+/* blocks until a pending seek is handled and enough is decoded to start.
+ * Only called while the stream is stopped. */
+static void stream_prefetch(StreamPlayer *sp)
+{
+	size_t want = STREAM_PREFETCH * (size_t)sp->info.channels;
+	int tries;
+	for (tries = 0; tries < 500; ++tries)
+	{
+		if (atomic_get(&sp->seek_handled) == sp->seek_request)
+		{
+			/* the callback is not running, so drop the old data here to
+			 * make room for the decoder */
+			stream_flush(sp, 0);
+			if (atomic_get(&sp->write) - sp->read >= want || STREAM_NOEND != atomic_get(&sp->end))
+				return;
+		}
+		hres_sleep(.001);
+	}
+}
+
+static int lhc_stream_play(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+
+	if (1 != Pa_IsStreamActive(sp->stream))
+	{
+		if (0 == Pa_IsStreamStopped(sp->stream))
+			Pa_StopStream(sp->stream);
+
+		stream_prefetch(sp);
+		PaError err = Pa_StartStream(sp->stream);
+		if (err != paNoError)
+			return luaL_error(L, "Cannot play stream: %s", Pa_GetErrorText(err));
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_stream_pause(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+
+	if (0 == Pa_IsStreamStopped(sp->stream))
+	{
+		PaError err = Pa_StopStream(sp->stream);
+		if (err != paNoError)
+			return luaL_error(L, "Cannot pause stream: %s", Pa_GetErrorText(err));
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_stream_seekTo(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+	lua_Integer pos  = luaL_checkinteger(L, 2);
+
+	if (pos < 0 || pos > (lua_Integer)sp->info.frames)
+		return luaL_error(L, "Cannot seek to frame %d: out of bounds", (int)pos);
+
+	mutex_lock(sp->lock);
+	sp->seek_frame = (size_t)pos;
+	sp->seek_request++;
+	cond_signal(sp->cond);
+	mutex_unlock(sp->lock);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* player:tell() -- frame and time in seconds of what is being played */
+static int lhc_stream_tell(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+
+	/* until the callback catches up, report the requested position */
+	size_t pos = atomic_get(&sp->seek_applied) != sp->seek_request
+		? sp->seek_frame : atomic_get(&sp->pos);
+
+	lua_pushinteger(L, (lua_Integer)pos);
+	lua_pushnumber(L, (double)pos / sp->info.samplerate);
+	return 2;
+}
+
+static int lhc_stream_seek(lua_State *L)
+{
+	lhc_checkstream(L, 1);
+	int delta = luaL_checkint(L, 2);
+
+	lua_settop(L, 1);
+	lhc_stream_tell(L);
+	lua_pushinteger(L, lua_tointeger(L, 2) + delta);
+	lua_replace(L, 2);
+	lua_settop(L, 2);
+	return lhc_stream_seekTo(L);
+}
+
+static int lhc_stream_rewind(lua_State *L)
+{
+	lua_settop(L, 1);
+	lua_pushinteger(L, 0);
+	return lhc_stream_seekTo(L);
+}
+
+static int lhc_stream_stop(lua_State *L)
+{
+	lhc_stream_pause(L);
+	return lhc_stream_rewind(L);
+}
+
+/* player:loop([flag]) */
+static int lhc_stream_loop(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+	if (!lua_isnoneornil(L, 2))
+	{
+		mutex_lock(sp->lock);
+		atomic_set(&sp->is_looping, lua_toboolean(L, 2));
+		cond_signal(sp->cond);
+		mutex_unlock(sp->lock);
+	}
+
+	lua_pushboolean(L, atomic_get(&sp->is_looping));
+	return 1;
+}
+
+/* player:underruns() -- number of blocks the decoder could not fill in time */
+static int lhc_stream_underruns(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+	lua_pushinteger(L, atomic_get(&sp->underruns));
+	return 1;
+}
+
+/* player:stats() */
+static int lhc_stream_stats(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+	return lhc_player_pushstats(L, &sp->stats, sp->stream);
+}
+
+/* player:info() -- frames, sample rate and channels of the file */
+static int lhc_stream_info(lua_State *L)
+{
+	StreamPlayer *sp = lhc_checkstream(L, 1);
+	lua_pushinteger(L, (lua_Integer)sp->info.frames);
+	lua_pushinteger(L, sp->info.samplerate);
+	lua_pushinteger(L, sp->info.channels);
+	return 3;
+}
+
+static int lhc_stream___gc(lua_State *L)
+{
+	StreamPlayer *sp = (StreamPlayer *)lua_touserdata(L, 1);
+
+	if (NULL != sp->stream)
+	{
+		PaError err = Pa_CloseStream(sp->stream);
+		if (err != paNoError)
+			fprintf(stderr, "Unable to close player stream: %s\n", Pa_GetErrorText(err));
+	}
+	sp->stream = NULL;
+
+	if (NULL != sp->thread)
+	{
+		mutex_lock(sp->lock);
+		sp->stop = 1;
+		cond_signal(sp->cond);
+		mutex_unlock(sp->lock);
+		thread_join(sp->thread);
+	}
+	sp->thread = NULL;
+
+	if (NULL != sp->lock)
+		mutex_destroy(sp->lock);
+	if (NULL != sp->cond)
+		cond_destroy(sp->cond);
+	sp->lock = NULL;
+	sp->cond = NULL;
+
+	if (NULL != sp->sf)
+		sf_close(sp->sf);
+	sp->sf = NULL;
+
+	free(sp->ring);
+	sp->ring = NULL;
+
+	return 0;
+}
+
+int lhc_player_stream(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+
+	PlayerOptions opts;
+	player_checkoptions(L, 2, &opts);
+
+	StreamPlayer *sp = (StreamPlayer *)lua_newuserdata(L, sizeof(StreamPlayer));
+	memset(sp, 0, sizeof(StreamPlayer));
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_stream___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_stream_play);
+		lua_setfield(L, -2, "play");
+
+		lua_pushcfunction(L, lhc_stream_pause);
+		lua_setfield(L, -2, "pause");
+
+		lua_pushcfunction(L, lhc_stream_stop);
+		lua_setfield(L, -2, "stop");
+
+		lua_pushcfunction(L, lhc_stream_rewind);
+		lua_setfield(L, -2, "rewind");
+
+		lua_pushcfunction(L, lhc_stream_seekTo);
+		lua_setfield(L, -2, "seekTo");
+
+		lua_pushcfunction(L, lhc_stream_seek);
+		lua_setfield(L, -2, "seek");
+
+		lua_pushcfunction(L, lhc_stream_tell);
+		lua_setfield(L, -2, "tell");
+
+		lua_pushcfunction(L, lhc_stream_loop);
+		lua_setfield(L, -2, "loop");
+
+		lua_pushcfunction(L, lhc_stream_underruns);
+		lua_setfield(L, -2, "underruns");
+
+		lua_pushcfunction(L, lhc_stream_info);
+		lua_setfield(L, -2, "info");
+
+		lua_pushcfunction(L, lhc_stream_stats);
+		lua_setfield(L, -2, "stats");
+	}
+	lua_setmetatable(L, -2);
+
+	/* only the header is read here; decoding happens on the thread */
+	sp->sf = sf_open(path, SFM_READ, &sp->info);
+	if (NULL == sp->sf)
+		return luaL_error(L, "Cannot open `%s' for reading: %s",
+				path, sf_strerror(NULL));
+
+	sp->capacity   = STREAM_RINGFRAMES * (size_t)sp->info.channels;
+	sp->ring       = (float *)malloc(sp->capacity * sizeof(float));
+	sp->end        = STREAM_NOEND;
+	sp->is_looping = opts.is_looping;
+	if (NULL == sp->ring)
+		return luaL_error(L, "Out of memory");
+
+	sp->lock = mutex_create();
+	sp->cond = cond_create();
+	if (NULL == sp->lock || NULL == sp->cond)
+		return luaL_error(L, "Cannot create decoder thread");
+	sp->thread = thread_create(stream_decode, sp);
+	if (NULL == sp->thread)
+		return luaL_error(L, "Cannot create decoder thread");
+
+	PaError err = player_open_stream(&sp->stream, sp->info.channels,
+			sp->info.samplerate, &opts, stream_callback, sp);
+	if (err != paNoError)
+	{
+		sp->stream = NULL;
+		return luaL_error(L, "Cannot create player stream: %s", Pa_GetErrorText(err));
+	}
+
+	return 1;
+}
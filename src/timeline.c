@@ -0,0 +1,386 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "mix.h"
+#include "parallel.h"
+#include "timeline.h"
+
+static const char *INTERNAL_NAME = "lhc.timeline";
+
+#define TIMELINE_BLOCKSIZE 1024 /* frames */
+#define TIMELINE_GRAIN     16
+#define TIMELINE_CHUNK     (TIMELINE_BLOCKSIZE * TIMELINE_GRAIN)
+
+typedef struct {
+	const float *data;
+	size_t       start;  /* frames */
+	size_t       frames;
+	size_t       seq;
+	float        gain;
+} TimelineEvent;
+
+typedef struct {
+	double         rate;
+	int            channels;
+	int            sorted;
+	size_t         nevents;
+	size_t         capacity;
+	TimelineEvent *events;
+	size_t         length;  /* frames, end of the latest event */
+} Timeline;
+
+static Timeline *lhc_checktimeline(lua_State *L, int idx)
+{
+	return (Timeline *)luaL_checkudata(L, idx, INTERNAL_NAME);
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+	const TimelineEvent *ea = (const TimelineEvent *)a;
+	const TimelineEvent *eb = (const TimelineEvent *)b;
+	if (ea->start != eb->start)
+		return ea->start < eb->start ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq);
+}
+
+/* sort events by start, which keeps the mixing order stable */
+static void timeline_sort(Timeline *tl)
+{
+	if (tl->sorted)
+		return;
+
+	qsort(tl->events, tl->nevents, sizeof(TimelineEvent), event_cmp);
+	tl->sorted = 1;
+}
+
+static size_t timeline_frames(Timeline *tl)
+{
+	return tl->length;
+}
+
+/* tl:place(buffer, time [, gain]) */
+static int lhc_timeline_place(lua_State *L)
+{
+	Timeline *tl = lhc_checktimeline(L, 1);
+	float *buf   = lhc_checkbuffer(L, 2);
+	size_t size  = lhc_buffer_nsamples(L, 2);
+	double time  = luaL_checknumber(L, 3);
+	float gain   = (float)luaL_optnumber(L, 4, 1.);
+
+	if (time < 0.)
+		return luaL_argerror(L, 3, "time must not be negative");
+	if (size % tl->channels != 0)
+		return luaL_error(L, "Buffer size mismatches number of channels");
+
+	if (tl->nevents == tl->capacity)
+	{
+		size_t capacity = tl->capacity > 0 ? 2 * tl->capacity : 16;
+		TimelineEvent *events = realloc(tl->events, capacity * sizeof(TimelineEvent));
+		if (NULL == events)
+			return luaL_error(L, "Cannot grow timeline");
+		tl->events   = events;
+		tl->capacity = capacity;
+	}
+
+	TimelineEvent *ev = &tl->events[tl->nevents];
+	ev->data   = buf;
+	ev->start  = (size_t)floor(time * tl->rate + .5);
+	ev->frames = size / tl->channels;
+	ev->seq    = tl->nevents;
+	ev->gain   = gain;
+	++tl->nevents;
+	tl->sorted = 0;
+	if (ev->start + ev->frames > tl->length)
+		tl->length = ev->start + ev->frames;
+
+	/* keep the buffer alive: env[#env+1] = buffer */
+	lua_getfenv(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, (int)lua_objlen(L, -2) + 1);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* Each chunk of TIMELINE_GRAIN blocks gets the list of events that overlap
+ * it (index[first[c] .. first[c+1]-1]), in start order, plus scratch space
+ * for the same number of active sources. Long events appear in every chunk
+ * they span, but a chunk never visits events outside of it. */
+typedef struct {
+	Timeline  *tl;
+	float     *out;
+	size_t     from;   /* frames */
+	size_t     frames;
+	size_t    *first;
+	size_t    *index;
+	MixSource *active;
+	size_t    *active_end;
+} TimelineJob;
+
+static void timeline_render_blocks(void *ud, size_t begin, size_t end)
+{
+	TimelineJob *job   = (TimelineJob *)ud;
+	Timeline *tl       = job->tl;
+	size_t channels    = (size_t)tl->channels;
+	size_t chunk       = begin / TIMELINE_GRAIN;
+	const size_t *next = job->index + job->first[chunk];
+	const size_t *last = job->index + job->first[chunk + 1];
+	MixSource *active  = job->active + job->first[chunk];
+	size_t *active_end = job->active_end + job->first[chunk];
+	size_t nactive     = 0;
+
+	for (size_t block = begin; block < end; ++block)
+	{
+		size_t pos = block * TIMELINE_BLOCKSIZE;
+		size_t n   = pos + TIMELINE_BLOCKSIZE < job->frames ? TIMELINE_BLOCKSIZE : job->frames - pos;
+		size_t b0  = job->from + pos, b1 = b0 + n;
+		float *out = job->out + pos * channels;
+		memset(out, 0, n * channels * sizeof(float));
+
+		for (; next < last && tl->events[*next].start < b1; ++next)
+		{
+			const TimelineEvent *ev = &tl->events[*next];
+			if (ev->start + ev->frames <= b0)
+				continue;
+
+			MixSource *s = &active[nactive];
+			s->data   = ev->data;
+			s->len    = ev->frames * channels;
+			s->offset = ((ptrdiff_t)ev->start - (ptrdiff_t)job->from) * (ptrdiff_t)channels;
+			s->gain   = ev->gain;
+			active_end[nactive++] = ev->start + ev->frames;
+		}
+
+		mix_sources(out, pos * channels, n * channels, active, nactive);
+
+		/* retire events that end within this block */
+		size_t k = 0;
+		for (size_t i = 0; i < nactive; ++i)
+		{
+			if (active_end[i] <= b1)
+				continue;
+			active[k]       = active[i];
+			active_end[k++] = active_end[i];
+		}
+		nactive = k;
+	}
+}
+
+/* chunks [*c0, *c1) of the job that event ev overlaps */
+static int timeline_event_chunks(const TimelineJob *job, const TimelineEvent *ev,
+		size_t *c0, size_t *c1)
+{
+	size_t end = ev->start + ev->frames;
+	if (0 == ev->frames || end <= job->from || ev->start >= job->from + job->frames)
+		return 0;
+
+	size_t lo = ev->start > job->from ? ev->start - job->from : 0;
+	size_t hi = end - job->from < job->frames ? end - job->from : job->frames;
+	*c0 = lo / TIMELINE_CHUNK;
+	*c1 = (hi - 1) / TIMELINE_CHUNK + 1;
+	return 1;
+}
+
+/* fills job->first and allocates the per-chunk event lists */
+static int timeline_bucket(TimelineJob *job, size_t nchunks)
+{
+	Timeline *tl = job->tl;
+	size_t c0, c1;
+
+	job->first = calloc(nchunks + 1, sizeof(size_t));
+	if (NULL == job->first)
+		return 0;
+
+	for (size_t i = 0; i < tl->nevents; ++i)
+		if (timeline_event_chunks(job, &tl->events[i], &c0, &c1))
+			for (size_t c = c0; c < c1; ++c)
+				job->first[c + 1]++;
+	for (size_t c = 0; c < nchunks; ++c)
+		job->first[c + 1] += job->first[c];
+
+	size_t total     = job->first[nchunks];
+	job->index       = malloc(total * sizeof(size_t) + 1);
+	job->active      = malloc(total * sizeof(MixSource) + 1);
+	job->active_end  = malloc(total * sizeof(size_t) + 1);
+	size_t *fill     = malloc(nchunks * sizeof(size_t) + 1);
+	if (NULL == job->index || NULL == job->active || NULL == job->active_end || NULL == fill)
+	{
+		free(fill);
+		return 0;
+	}
+
+	memcpy(fill, job->first, nchunks * sizeof(size_t));
+	for (size_t i = 0; i < tl->nevents; ++i)
+		if (timeline_event_chunks(job, &tl->events[i], &c0, &c1))
+			for (size_t c = c0; c < c1; ++c)
+				job->index[fill[c]++] = i;
+
+	free(fill);
+	return 1;
+}
+
+/* tl:render([from [, to]]) -- times in seconds */
+static int lhc_timeline_render(lua_State *L)
+{
+	Timeline *tl = lhc_checktimeline(L, 1);
+	size_t total = timeline_frames(tl);
+	double from  = luaL_optnumber(L, 2, 0.);
+	double to    = luaL_optnumber(L, 3, (double)total / tl->rate);
+
+	if (from < 0. || to < from)
+		return luaL_error(L, "Invalid time range [%f, %f]", from, to);
+
+	TimelineJob job;
+	memset(&job, 0, sizeof job);
+	job.tl     = tl;
+	job.from   = (size_t)floor(from * tl->rate + .5);
+	job.frames = (size_t)floor(to * tl->rate + .5) - job.from;
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, job.frames * tl->channels);
+	lua_call(L, 1, 1);
+	job.out = (float *)lua_touserdata(L, -1);
+
+	timeline_sort(tl);
+	size_t nblocks = (job.frames + TIMELINE_BLOCKSIZE - 1) / TIMELINE_BLOCKSIZE;
+	size_t nchunks = (nblocks + TIMELINE_GRAIN - 1) / TIMELINE_GRAIN;
+	int ok = timeline_bucket(&job, nchunks);
+
+	/* disjoint time ranges render independently */
+	if (ok)
+		parallel_for(nblocks, TIMELINE_GRAIN, timeline_render_blocks, &job);
+
+	free(job.first);
+	free(job.index);
+	free(job.active);
+	free(job.active_end);
+	if (!ok)
+		return luaL_error(L, "Out of memory rendering timeline");
+
+	return 1;
+}
+
+static int lhc_timeline_length(lua_State *L)
+{
+	Timeline *tl = lhc_checktimeline(L, 1);
+	lua_pushnumber(L, (lua_Number)timeline_frames(tl) / tl->rate);
+	return 1;
+}
+
+static int lhc_timeline_clear(lua_State *L)
+{
+	Timeline *tl = lhc_checktimeline(L, 1);
+	tl->nevents = 0;
+	tl->sorted  = 0;
+	tl->length  = 0;
+
+	lua_newtable(L);
+	lua_setfenv(L, 1);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lhc_timeline___len(lua_State *L)
+{
+	Timeline *tl = lhc_checktimeline(L, 1);
+	lua_pushinteger(L, tl->nevents);
+	return 1;
+}
+
+static int lhc_timeline___gc(lua_State *L)
+{
+	Timeline *tl = (Timeline *)lua_touserdata(L, 1);
+	free(tl->events);
+	return 0;
+}
+
+/* lhc.timeline([rate [, channels]]) */
+int lhc_timeline_new(lua_State *L)
+{
+	double rate  = luaL_optnumber(L, 1, 44100.);
+	int channels = luaL_optint(L, 2, 1);
+	luaL_argcheck(L, rate > 0., 1, "sample rate must be positive");
+	luaL_argcheck(L, channels > 0, 2, "need at least one channel");
+
+	Timeline *tl = (Timeline *)lua_newuserdata(L, sizeof(Timeline));
+	tl->rate     = rate;
+	tl->channels = channels;
+	tl->sorted   = 1;
+	tl->nevents  = 0;
+	tl->capacity = 0;
+	tl->events   = NULL;
+	tl->length   = 0;
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_timeline___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_timeline___len);
+		lua_setfield(L, -2, "__len");
+
+		lua_pushcfunction(L, lhc_timeline_place);
+		lua_setfield(L, -2, "place");
+
+		lua_pushcfunction(L, lhc_timeline_render);
+		lua_setfield(L, -2, "render");
+
+		lua_pushcfunction(L, lhc_timeline_length);
+		lua_setfield(L, -2, "length");
+
+		lua_pushcfunction(L, lhc_timeline_clear);
+		lua_setfield(L, -2, "clear");
+	}
+	lua_setmetatable(L, -2);
+
+	/* environment table keeps the placed buffers alive */
+	lua_newtable(L);
+	lua_setfenv(L, -2);
+
+	return 1;
+}
+
+int luaopen_lhc_timeline(lua_State *L)
+{
+	lua_pushcfunction(L, lhc_timeline_new);
+	return 1;
+}
@@ -0,0 +1,686 @@
+/***
+ * Copyright (c) 2012 Matthias Richter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the sale,
+ * use or other dealings in this Software without prior written authorization.
+ *
+ * If you find yourself in a situation where you can safe the author's life
+ * without risking your own safety, you are obliged to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <sndfile.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buffer.h"
+#include "noise.h"
+#include "osfunc.h"
+#include "soundfile.h"
+#include "ugen.h"
+
+#define TWO_PI 6.283185307179586
+#define UGEN_MAXINPUTS 2
+
+static const char *INTERNAL_NAME = "lhc.ugen";
+
+/*
+ * Unit generators produce one block of UGEN_BLOCKSIZE samples at a time.
+ * A sink pulls its node with a fresh stamp; every node pulls its inputs
+ * first and computes its block at most once per stamp, so shared nodes
+ * are evaluated once. Memory is one block per node, regardless of the
+ * length of the output.
+ */
+typedef struct UGen UGen;
+typedef void (*ugen_tick)(UGen *u, size_t n);
+
+struct UGen {
+	ugen_tick      tick;
+	void         (*cleanup)(UGen *u);
+	UGen          *in[UGEN_MAXINPUTS]; /* NULL: use the constant in k */
+	float          k[UGEN_MAXINPUTS];
+	double         rate;
+	unsigned long  stamp;
+	double         state[4];
+	void          *data;
+	size_t         len;
+	size_t         pos;
+	float          out[UGEN_BLOCKSIZE];
+};
+
+static unsigned long ugen_clock = 0;
+
+int lua_isugen(lua_State *L, int idx)
+{
+	if (NULL == lua_touserdata(L, idx) || !lua_getmetatable(L, idx))
+		return 0;
+
+	luaL_getmetatable(L, INTERNAL_NAME);
+	int equal = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+	return equal;
+}
+
+static UGen *lhc_checkugen(lua_State *L, int idx)
+{
+	return (UGen *)luaL_checkudata(L, idx, INTERNAL_NAME);
+}
+
+inline static float ugen_in(const UGen *u, int i, size_t k)
+{
+	return NULL != u->in[i] ? u->in[i]->out[k] : u->k[i];
+}
+
+static void ugen_pull(UGen *u, unsigned long stamp, size_t n)
+{
+	if (u->stamp == stamp)
+		return;
+	u->stamp = stamp;
+
+	for (int i = 0; i < UGEN_MAXINPUTS; ++i)
+		if (NULL != u->in[i])
+			ugen_pull(u->in[i], stamp, n);
+
+	u->tick(u, n);
+}
+
+/*
+ * sources
+ */
+static void ugen_tick_sine(UGen *u, size_t n)
+{
+	double phase = u->state[0];
+	for (size_t k = 0; k < n; ++k)
+	{
+		u->out[k] = (float)sin(TWO_PI * phase);
+		phase += ugen_in(u, 0, k) / u->rate;
+		phase -= floor(phase);
+	}
+	u->state[0] = phase;
+}
+
+static void ugen_tick_saw(UGen *u, size_t n)
+{
+	double phase = u->state[0];
+	for (size_t k = 0; k < n; ++k)
+	{
+		u->out[k] = (float)(2. * phase - 1.);
+		phase += ugen_in(u, 0, k) / u->rate;
+		phase -= floor(phase);
+	}
+	u->state[0] = phase;
+}
+
+static void ugen_tick_square(UGen *u, size_t n)
+{
+	double phase = u->state[0];
+	for (size_t k = 0; k < n; ++k)
+	{
+		u->out[k] = phase < ugen_in(u, 1, k) ? 1.f : -1.f;
+		phase += ugen_in(u, 0, k) / u->rate;
+		phase -= floor(phase);
+	}
+	u->state[0] = phase;
+}
+
+static void ugen_tick_noise(UGen *u, size_t n)
+{
+	lhc_rng *rng = (lhc_rng *)u->data;
+	for (size_t k = 0; k < n; ++k)
+		u->out[k] = 2.f * lhc_rng_float(rng) - 1.f;
+}
+
+/* linear segments: data = {levels[len+1], times[len] (in samples)} */
+static void ugen_tick_env(UGen *u, size_t n)
+{
+	const double *levels = (const double *)u->data;
+	const double *times  = levels + u->len + 1;
+	size_t seg = u->pos;
+	double t   = u->state[0];
+
+	for (size_t k = 0; k < n; ++k)
+	{
+		while (seg < u->len && t >= times[seg])
+		{
+			t -= times[seg];
+			++seg;
+		}
+
+		if (seg >= u->len)
+			u->out[k] = (float)levels[u->len];
+		else
+			u->out[k] = (float)(levels[seg] + (levels[seg+1] - levels[seg]) * t / times[seg]);
+		t += 1.;
+	}
+
+	u->pos      = seg;
+	u->state[0] = t;
+}
+
+/* data = buffer samples, state[0] = loop flag */
+static void ugen_tick_buffer(UGen *u, size_t n)
+{
+	const float *buf = (const float *)u->data;
+	for (size_t k = 0; k < n; ++k)
+	{
+		if (u->pos >= u->len && u->state[0] != 0. && u->len > 0)
+			u->pos = 0;
+		u->out[k] = u->pos < u->len ? buf[u->pos++] : 0.f;
+	}
+}
+
+typedef struct {
+	SNDFILE *sf;
+	SF_INFO  info;
+	int      channel; /* 0: mix down */
+	float    frames[];
+} UGenFile;
+
+static void ugen_tick_file(UGen *u, size_t n)
+{
+	UGenFile *f  = (UGenFile *)u->data;
+	int channels = f->info.channels;
+	sf_count_t got = NULL != f->sf ? sf_readf_float(f->sf, f->frames, (sf_count_t)n) : 0;
+	if (got < 0)
+		got = 0;
+
+	for (size_t k = 0; k < (size_t)got; ++k)
+	{
+		const float *frame = f->frames + k * channels;
+		if (f->channel > 0)
+			u->out[k] = frame[f->channel - 1];
+		else
+		{
+			float x = 0.f;
+			for (int c = 0; c < channels; ++c)
+				x += frame[c];
+			u->out[k] = x / (float)channels;
+		}
+	}
+
+	for (size_t k = (size_t)got; k < n; ++k)
+		u->out[k] = 0.f;
+}
+
+static void ugen_cleanup_file(UGen *u)
+{
+	UGenFile *f = (UGenFile *)u->data;
+	if (NULL != f && NULL != f->sf)
+		sf_close(f->sf);
+	free(f);
+}
+
+static void ugen_cleanup_free(UGen *u)
+{
+	free(u->data);
+}
+
+/*
+ * arithmetic and filters
+ */
+#define UGEN_BINOP(name, op)                                 \
+	static void ugen_tick_##name(UGen *u, size_t n)          \
+	{                                                        \
+		for (size_t k = 0; k < n; ++k)                       \
+			u->out[k] = ugen_in(u, 0, k) op ugen_in(u, 1, k); \
+	}
+UGEN_BINOP(add, +)
+UGEN_BINOP(sub, -)
+UGEN_BINOP(mul, *)
+UGEN_BINOP(div, /)
+#undef UGEN_BINOP
+
+static void ugen_tick_unm(UGen *u, size_t n)
+{
+	for (size_t k = 0; k < n; ++k)
+		u->out[k] = -ugen_in(u, 0, k);
+}
+
+/* one-pole filters, state[0] = last lowpass output */
+static void ugen_tick_lowpass(UGen *u, size_t n)
+{
+	double y = u->state[0];
+	for (size_t k = 0; k < n; ++k)
+	{
+		double a = 1. - exp(-TWO_PI * ugen_in(u, 1, k) / u->rate);
+		y += a * (ugen_in(u, 0, k) - y);
+		u->out[k] = (float)y;
+	}
+	u->state[0] = y;
+}
+
+static void ugen_tick_highpass(UGen *u, size_t n)
+{
+	double y = u->state[0];
+	for (size_t k = 0; k < n; ++k)
+	{
+		double a = 1. - exp(-TWO_PI * ugen_in(u, 1, k) / u->rate);
+		float x  = ugen_in(u, 0, k);
+		y += a * (x - y);
+		u->out[k] = x - (float)y;
+	}
+	u->state[0] = y;
+}
+
+/*
+ * construction
+ */
+static int lhc_ugen___gc(lua_State *L);
+static int lhc_ugen___add(lua_State *L);
+static int lhc_ugen___sub(lua_State *L);
+static int lhc_ugen___mul(lua_State *L);
+static int lhc_ugen___div(lua_State *L);
+static int lhc_ugen___unm(lua_State *L);
+static int lhc_ugen_render(lua_State *L);
+static int lhc_ugen_write(lua_State *L);
+
+static UGen *ugen_push(lua_State *L, ugen_tick tick, double rate)
+{
+	UGen *u = (UGen *)lua_newuserdata(L, sizeof(UGen));
+	memset(u, 0, sizeof(UGen));
+	u->tick = tick;
+	u->rate = rate;
+
+	if (luaL_newmetatable(L, INTERNAL_NAME))
+	{
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lhc_ugen___gc);
+		lua_setfield(L, -2, "__gc");
+
+		lua_pushcfunction(L, lhc_ugen___add);
+		lua_setfield(L, -2, "__add");
+
+		lua_pushcfunction(L, lhc_ugen___sub);
+		lua_setfield(L, -2, "__sub");
+
+		lua_pushcfunction(L, lhc_ugen___mul);
+		lua_setfield(L, -2, "__mul");
+
+		lua_pushcfunction(L, lhc_ugen___div);
+		lua_setfield(L, -2, "__div");
+
+		lua_pushcfunction(L, lhc_ugen___unm);
+		lua_setfield(L, -2, "__unm");
+
+		lua_pushcfunction(L, lhc_ugen_render);
+		lua_setfield(L, -2, "render");
+
+		lua_pushcfunction(L, lhc_ugen_write);
+		lua_setfield(L, -2, "write");
+	}
+	lua_setmetatable(L, -2);
+
+	/* environment table keeps inputs alive */
+	lua_newtable(L);
+	lua_setfenv(L, -2);
+
+	return u;
+}
+
+/* input from node or number at idx; the new node must be on top */
+static void ugen_setinput(lua_State *L, UGen *u, int slot, int idx, float def)
+{
+	if (lua_isugen(L, idx))
+	{
+		u->in[slot] = (UGen *)lua_touserdata(L, idx);
+		lua_getfenv(L, -1);
+		lua_pushvalue(L, idx);
+		lua_rawseti(L, -2, slot + 1);
+		lua_pop(L, 1);
+	}
+	else
+		u->k[slot] = (float)luaL_optnumber(L, idx, def);
+}
+
+/* the common sample rate of the ugens at a and b, def if neither is one */
+static double ugen_inputrate(lua_State *L, int a, int b, double def)
+{
+	int has_a = lua_isugen(L, a), has_b = lua_isugen(L, b);
+	double ra = has_a ? ((UGen *)lua_touserdata(L, a))->rate : def;
+	double rb = has_b ? ((UGen *)lua_touserdata(L, b))->rate : ra;
+	if (!has_a)
+		ra = rb;
+	if (ra != rb)
+		luaL_error(L, "Cannot combine ugens with sample rates %f and %f", ra, rb);
+	return ra;
+}
+
+/* lhc.ugen.sine(freq [, rate]) and friends */
+static int ugen_oscillator(lua_State *L, ugen_tick tick)
+{
+	double rate = luaL_optnumber(L, 2, 44100.);
+	luaL_argcheck(L, rate > 0., 2, "sample rate must be positive");
+	UGen *u = ugen_push(L, tick, rate);
+	ugen_setinput(L, u, 0, 1, 440.f);
+	return 1;
+}
+
+static int lhc_ugen_sine(lua_State *L)
+{
+	return ugen_oscillator(L, ugen_tick_sine);
+}
+
+static int lhc_ugen_saw(lua_State *L)
+{
+	return ugen_oscillator(L, ugen_tick_saw);
+}
+
+/* lhc.ugen.square(freq [, width [, rate]]) */
+static int lhc_ugen_square(lua_State *L)
+{
+	double rate = luaL_optnumber(L, 3, 44100.);
+	luaL_argcheck(L, rate > 0., 3, "sample rate must be positive");
+	UGen *u = ugen_push(L, ugen_tick_square, rate);
+	ugen_setinput(L, u, 0, 1, 440.f);
+	ugen_setinput(L, u, 1, 2, .5f);
+	return 1;
+}
+
+/* lhc.ugen.noise([seed [, rate]]) */
+static int lhc_ugen_noise(lua_State *L)
+{
+	uint64_t seed = (uint64_t)luaL_optinteger(L, 1, (lua_Integer)(hres_time() * 1e6));
+	double rate   = luaL_optnumber(L, 2, 44100.);
+	luaL_argcheck(L, rate > 0., 2, "sample rate must be positive");
+	lhc_rng *rng  = malloc(sizeof(lhc_rng));
+	if (NULL == rng)
+		return luaL_error(L, "Cannot create noise generator");
+	lhc_rng_seed(rng, seed, 0);
+
+	UGen *u    = ugen_push(L, ugen_tick_noise, rate);
+	u->data    = rng;
+	u->cleanup = ugen_cleanup_free;
+	return 1;
+}
+
+/* lhc.ugen.env(levels, times [, rate]) -- linear segments, times in seconds */
+static int lhc_ugen_env(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	double rate = luaL_optnumber(L, 3, 44100.);
+	size_t n    = lua_objlen(L, 2);
+
+	if (lua_objlen(L, 1) <= n)
+		return luaL_argerror(L, 2, "Number of levels must be greater than number of delays");
+
+	double *data = malloc((2 * n + 1) * sizeof(double));
+	if (NULL == data)
+		return luaL_error(L, "Cannot create envelope");
+
+	for (size_t i = 0; i <= n; ++i)
+	{
+		lua_rawgeti(L, 1, (int)i + 1);
+		data[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	for (size_t i = 0; i < n; ++i)
+	{
+		lua_rawgeti(L, 2, (int)i + 1);
+		data[n + 1 + i] = fmax(lua_tonumber(L, -1) * rate, 1.);
+		lua_pop(L, 1);
+	}
+
+	UGen *u    = ugen_push(L, ugen_tick_env, rate);
+	u->data    = data;
+	u->len     = n;
+	u->cleanup = ugen_cleanup_free;
+	return 1;
+}
+
+/* lhc.ugen.buffer(buffer [, loop [, rate]]) */
+static int lhc_ugen_buffer(lua_State *L)
+{
+	float *buf  = lhc_checkbuffer(L, 1);
+	double rate = luaL_optnumber(L, 3, 44100.);
+	luaL_argcheck(L, rate > 0., 3, "sample rate must be positive");
+	UGen *u     = ugen_push(L, ugen_tick_buffer, rate);
+	u->data     = buf;
+	u->len      = lhc_buffer_nsamples(L, 1);
+	u->state[0] = lua_toboolean(L, 2);
+
+	lua_getfenv(L, -1);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+	lua_pop(L, 1);
+	return 1;
+}
+
+/* lhc.ugen.file(path [, channel]) -- channel 0 mixes all channels */
+static int lhc_ugen_file(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	int channel      = luaL_optint(L, 2, 0);
+
+	SF_INFO info;
+	memset(&info, 0, sizeof info);
+	SNDFILE *sf = sf_open(path, SFM_READ, &info);
+	if (NULL == sf)
+		return luaL_error(L, "Cannot open `%s' for reading: %s",
+				path, sf_strerror(NULL));
+
+	if (channel < 0 || channel > info.channels)
+	{
+		sf_close(sf);
+		return luaL_argerror(L, 2, "no such channel");
+	}
+
+	UGenFile *f = malloc(sizeof(UGenFile) + (size_t)info.channels * UGEN_BLOCKSIZE * sizeof(float));
+	if (NULL == f)
+	{
+		sf_close(sf);
+		return luaL_error(L, "Cannot create file reader");
+	}
+	f->sf      = sf;
+	f->info    = info;
+	f->channel = channel;
+
+	UGen *u    = ugen_push(L, ugen_tick_file, info.samplerate);
+	u->data    = f;
+	u->cleanup = ugen_cleanup_file;
+	return 1;
+}
+
+/* lhc.ugen.lowpass(input, cutoff [, rate]) -- rate defaults to that of the
+ * input ugen(s) and must match it */
+static int ugen_filter(lua_State *L, ugen_tick tick)
+{
+	double rate = ugen_inputrate(L, 1, 2, luaL_optnumber(L, 3, 44100.));
+	if (!lua_isnoneornil(L, 3) && luaL_checknumber(L, 3) != rate)
+		return luaL_argerror(L, 3, "sample rate differs from the input");
+	luaL_argcheck(L, rate > 0., 3, "sample rate must be positive");
+	UGen *u = ugen_push(L, tick, rate);
+	ugen_setinput(L, u, 0, 1, 0.f);
+	ugen_setinput(L, u, 1, 2, 1000.f);
+	return 1;
+}
+
+static int lhc_ugen_lowpass(lua_State *L)
+{
+	return ugen_filter(L, ugen_tick_lowpass);
+}
+
+static int lhc_ugen_highpass(lua_State *L)
+{
+	return ugen_filter(L, ugen_tick_highpass);
+}
+
+static int ugen_binop(lua_State *L, ugen_tick tick)
+{
+	if (!lua_isugen(L, 1) && !lua_isnumber(L, 1))
+		return luaL_typerror(L, 1, "ugen or number");
+	if (!lua_isugen(L, 2) && !lua_isnumber(L, 2))
+		return luaL_typerror(L, 2, "ugen or number");
+
+	/* the result runs at the rate of its ugen operands */
+	UGen *u = ugen_push(L, tick, ugen_inputrate(L, 1, 2, 44100.));
+	ugen_setinput(L, u, 0, 1, 0.f);
+	ugen_setinput(L, u, 1, 2, 0.f);
+	return 1;
+}
+
+static int lhc_ugen___add(lua_State *L)
+{
+	return ugen_binop(L, ugen_tick_add);
+}
+
+static int lhc_ugen___sub(lua_State *L)
+{
+	return ugen_binop(L, ugen_tick_sub);
+}
+
+static int lhc_ugen___mul(lua_State *L)
+{
+	return ugen_binop(L, ugen_tick_mul);
+}
+
+static int lhc_ugen___div(lua_State *L)
+{
+	return ugen_binop(L, ugen_tick_div);
+}
+
+static int lhc_ugen___unm(lua_State *L)
+{
+	UGen *u = ugen_push(L, ugen_tick_unm, lhc_checkugen(L, 1)->rate);
+	ugen_setinput(L, u, 0, 1, 0.f);
+	return 1;
+}
+
+static int lhc_ugen___gc(lua_State *L)
+{
+	UGen *u = (UGen *)lua_touserdata(L, 1);
+	if (NULL != u->cleanup)
+		u->cleanup(u);
+	u->cleanup = NULL;
+	return 0;
+}
+
+/*
+ * sinks
+ */
+static unsigned long ugen_next_stamp(void)
+{
+	return atomic_add(&ugen_clock, 1) + 1;
+}
+
+/* node:render(n) -- the next n samples of the graph */
+static int lhc_ugen_render(lua_State *L)
+{
+	UGen *u       = lhc_checkugen(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "size must not be negative");
+
+	lua_pushcfunction(L, lhc_buffer_new);
+	lua_pushinteger(L, n);
+	lua_call(L, 1, 1);
+	float *out = (float *)lua_touserdata(L, -1);
+
+	for (size_t pos = 0; pos < (size_t)n; pos += UGEN_BLOCKSIZE)
+	{
+		size_t nb = (size_t)n - pos;
+		if (nb > UGEN_BLOCKSIZE)
+			nb = UGEN_BLOCKSIZE;
+
+		ugen_pull(u, ugen_next_stamp(), nb);
+		memcpy(out + pos, u->out, nb * sizeof(float));
+	}
+
+	return 1;
+}
+
+/* node:write(path, n [, rate [, bits [, options]]]) -- stream n samples into a file
+ * options are the same as for lhc.soundfile.write */
+static int lhc_ugen_write(lua_State *L)
+{
+	UGen *u          = lhc_checkugen(L, 1);
+	const char *path = luaL_checkstring(L, 2);
+	lua_Integer n    = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, n >= 0, 3, "size must not be negative");
+	const char *ext  = strrchr(path, '.');
+	if (NULL == ext)
+		return luaL_argerror(L, 2, "cannot determine file format");
+
+	SF_INFO info;
+	memset(&info, 0, sizeof info);
+	info.samplerate = luaL_optinteger(L, 4, (lua_Integer)u->rate);
+	info.channels   = 1;
+	info.format     = lhc_soundfile_checkformat(L, ext + 1, 5);
+
+	SoundfileOptions opts;
+	lhc_soundfile_checkoptions(L, 6, info.format, &opts);
+
+	SNDFILE *sf = sf_open(path, SFM_WRITE, &info);
+	if (NULL == sf)
+		return luaL_error(L, "Cannot open `%s' for writing: %s",
+				path, sf_strerror(NULL));
+
+	lhc_soundfile_set_compression(sf, opts.compression);
+	pcm_converter *pcm = lhc_soundfile_converter(&info, &opts);
+
+	for (size_t pos = 0; pos < (size_t)n; pos += UGEN_BLOCKSIZE)
+	{
+		size_t nb = (size_t)n - pos;
+		if (nb > UGEN_BLOCKSIZE)
+			nb = UGEN_BLOCKSIZE;
+
+		ugen_pull(u, ugen_next_stamp(), nb);
+		if (lhc_soundfile_write_samples(sf, pcm, u->out, nb) != nb)
+		{
+			lua_pushstring(L, sf_strerror(sf));
+			pcm_converter_free(pcm);
+			sf_close(sf);
+			return luaL_error(L, "Error writing `%s': %s", path, lua_tostring(L, -1));
+		}
+	}
+
+	pcm_converter_free(pcm);
+	sf_close(sf);
+	lua_settop(L, 1);
+	return 1;
+}
+
+#define lhc_register_function(L, func, name) \
+	lua_pushcfunction(L, func); \
+	lua_setfield(L, -2, name)
+int luaopen_lhc_ugen(lua_State *L)
+{
+	lua_createtable(L, 0, 12);
+	lhc_register_function(L, lhc_ugen_sine,     "sine");
+	lhc_register_function(L, lhc_ugen_saw,      "saw");
+	lhc_register_function(L, lhc_ugen_square,   "square");
+	lhc_register_function(L, lhc_ugen_noise,    "noise");
+	lhc_register_function(L, lhc_ugen_env,      "env");
+	lhc_register_function(L, lhc_ugen_buffer,   "buffer");
+	lhc_register_function(L, lhc_ugen_file,     "file");
+	lhc_register_function(L, lhc_ugen_lowpass,  "lowpass");
+	lhc_register_function(L, lhc_ugen_highpass, "highpass");
+
+	lua_pushinteger(L, UGEN_BLOCKSIZE);
+	lua_setfield(L, -2, "blocksize");
+	return 1;
+}
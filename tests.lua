@@ -481,6 +481,618 @@ describe("Buffers", function()
 			})
 		end)
 	end)
+
+	describe("files", function()
+		it("saves and loads the native format", function()
+			local buf = lhc.buffer(10000, function(i) return math.sin(i) / 3 end)
+			assert.are.equals(buf:save("buffer.lhc", 48000, 2), buf)
+			local b, rate, channels, tag = lhc.buffer.load("buffer.lhc")
+			assert.are.same({48000, 2}, {rate, channels})
+			assert.are.equals(("\0"):rep(16), tag)
+			assert.are.same({buf:get(1,-1)}, {b:get(1,-1)})
+			assert.are.equals((b + 1)[1], buf[1] + 1)
+		end)
+
+		it("detects damaged files", function()
+			lhc.buffer(1000, .5):save("buffer.lhc")
+			local f = io.open("buffer.lhc", "r+b")
+			f:seek("set", 100)
+			f:write("xxxx")
+			f:close()
+			assert.has_error(function() lhc.buffer.load("buffer.lhc", true) end)
+			assert.has_no.errors(function() lhc.buffer.load("buffer.lhc") end)
+			os.remove("buffer.lhc")
+			assert.has_error(function() lhc.buffer.load("buffer.lhc") end)
+		end)
+
+		it("rejects headers that do not match the file size", function()
+			lhc.buffer(1000, .5):save("buffer.lhc")
+			local f = io.open("buffer.lhc", "r+b")
+			f:seek("set", 24) -- nsamples
+			f:write(("\255"):rep(8))
+			f:close()
+			assert.has_error(function() lhc.buffer.load("buffer.lhc") end)
+
+			lhc.buffer(1000, .5):save("buffer.lhc")
+			f = io.open("buffer.lhc", "ab")
+			f:write("xxxx")
+			f:close()
+			assert.has_error(function() lhc.buffer.load("buffer.lhc") end)
+			os.remove("buffer.lhc")
+		end)
+	end)
+end)
+
+describe("Delay lines", function()
+	it("delays by whole samples", function()
+		local d = lhc.delay(8)
+		local b = d:process(lhc.buffer{1,0,0,0,0,0}, 3)
+		assert.are.same({0,0,0,1,0,0}, {b:get(1,-1)})
+	end)
+
+	it("interpolates fractional taps", function()
+		local d = lhc.delay(8)
+		d:push(1, 2, 3)
+		assert.are.equals(d:tap(1), 3)
+		assert.are.equals(d:tap(1.5), 2.5)
+		assert.are.equals(d:tap(3), 1)
+	end)
+
+	it("keeps its state across calls", function()
+		local d = lhc.delay(8)
+		d:process(lhc.buffer{0,0,1}, 2)
+		local b = d:process(lhc.buffer{0,0,0}, 2)
+		assert.are.same({0,1,0}, {b:get(1,-1)})
+	end)
+
+	it("accepts per-sample delay buffers", function()
+		local d = lhc.delay(8)
+		local b = d:process(lhc.buffer{1,0,0,0}, lhc.buffer{1,1,2,2})
+		assert.are.same({0,1,1,0}, {b:get(1,-1)})
+	end)
+end)
+
+describe("Reverb", function()
+	local click = lhc.buffer(4410, 0)
+	click[1] = 1
+
+	it("keeps the length without a tail", function()
+		local b = lhc.reverb(click)
+		assert.are.equals(#b, #click)
+	end)
+
+	it("appends a tail", function()
+		local b = lhc.reverb(click, {tail = 1, rate = 44100})
+		assert.are.equals(#b, #click + 44100)
+	end)
+
+	it("returns the dry signal with mix = 0", function()
+		local b = lhc.reverb(click, {mix = 0})
+		assert.are.same({click:get(1,-1)}, {b:get(1,-1)})
+	end)
+
+	it("decays", function()
+		local b = lhc.reverb(click, {decay = .5, mix = 1, tail = 3})
+		local peak = 0
+		for i = #b - 4410, #b do
+			peak = math.max(peak, math.abs(b[i]))
+		end
+		assert.is_true(peak < 1e-3)
+	end)
+
+	it("handles interleaved channels", function()
+		local b = lhc.reverb(click:zip(click), {channels = 2, tail = .1})
+		assert.are.equals(#b, 2 * (#click + 4410))
+	end)
+end)
+
+describe("Additive synthesis", function()
+	local function close(a, b, eps)
+		return math.abs(a - b) < (eps or 1e-4)
+	end
+
+	it("renders a single partial", function()
+		local b = lhc.additive(1000, {441}, {.5})
+		assert.are.equals(#b, 1000)
+		for i = 1,#b do
+			assert.is_true(close(b[i], .5 * math.sin((i-1)/44100 * 2 * math.pi * 441)))
+		end
+	end)
+
+	it("sums partials and honors phases", function()
+		local b = lhc.additive(100, {100, 200}, {1, 1}, {math.pi/2, 0}, 8000)
+		for i = 1,#b do
+			local t = (i-1)/8000 * 2 * math.pi
+			assert.is_true(close(b[i], math.cos(t * 100) + math.sin(t * 200)))
+		end
+	end)
+
+	it("ignores partials above nyquist", function()
+		local b = lhc.additive(100, {30000}, {1})
+		assert.are.same({lhc.buffer(100, 0):get(1,-1)}, {b:get(1,-1)})
+	end)
+
+	it("accepts amplitude envelopes", function()
+		-- a ramp across several blocks that holds its last value
+		local env = lhc.buffer(600, function(i) return (i-1)/599 end)
+		local b = lhc.additive(1000, {441, 882}, {env, .25})
+		for i = 1,#b do
+			local t = (i-1)/44100 * 2 * math.pi
+			local a = i <= 600 and (i-1)/599 or 1
+			assert.is_true(close(b[i], a * math.sin(t * 441) + .25 * math.sin(t * 882)))
+		end
+	end)
+end)
+
+describe("Wavetables", function()
+	local sine = lhc.buffer(256, function(i)
+		return math.sin((i-1)/256 * 2 * math.pi)
+	end)
+
+	it("caches tables with equal content", function()
+		local a = lhc.wavetable(sine)
+		local b = lhc.wavetable(sine:clone())
+		assert.is_true(rawequal(a, b))
+	end)
+
+	it("keeps recently used tables within a memory budget", function()
+		local _, budget = lhc.wavetable.cache()
+		local id = tostring(lhc.wavetable(sine * 3))
+		collectgarbage("collect")
+		assert.are.equals(tostring(lhc.wavetable(sine * 3)), id)
+
+		lhc.wavetable.cache(256 * 1024)
+		collectgarbage("collect")
+		local before = collectgarbage("count")
+		local first = lhc.wavetable(sine * 1)
+		for k = 2,200 do
+			lhc.wavetable(sine * k)
+		end
+		local used, _, entries = lhc.wavetable.cache()
+		assert.is_true(used <= 256 * 1024 and entries < 200)
+		collectgarbage("collect")
+		assert.is_true(collectgarbage("count") - before < 300)
+
+		-- the most recent table is still cached, the oldest is not
+		local newest = tostring(lhc.wavetable(sine * 200))
+		assert.are.equals(select(3, lhc.wavetable.cache()), entries)
+		assert.are.equals(tostring(lhc.wavetable(sine * 200)), newest)
+		assert.is_false(rawequal(first, lhc.wavetable(sine * 1)))
+
+		lhc.wavetable.cache(budget)
+	end)
+
+	it("builds mip-map levels", function()
+		local wt = lhc.wavetable(sine)
+		assert.are.equals(#wt, 256)
+		assert.are.equals(wt:levels(), 8)
+	end)
+
+	it("renders the table at a given frequency", function()
+		local b = lhc.wavetable(sine):render(1000, 100, 0, 10000)
+		assert.are.equals(#b, 1000)
+		for i = 1,#b do
+			local x = math.sin((i-1)/10000 * 100 * 2 * math.pi)
+			assert.is_true(math.abs(b[i] - x) < 1e-3)
+		end
+	end)
+
+	it("removes harmonics above nyquist", function()
+		local square = lhc.buffer(256, function(i) return i <= 128 and 1 or -1 end)
+		-- at 10kHz only the fundamental fits below nyquist
+		local b = lhc.wavetable(square):render(441, 10000)
+		local peak = 0
+		for i = 1,#b do peak = math.max(peak, math.abs(b[i])) end
+		assert.is_true(peak < 4/math.pi + 1e-2)
+	end)
+
+	it("accepts frequency and phase buffers", function()
+		local wt = lhc.wavetable(sine)
+		local b = wt:render(100, lhc.buffer(100, 0), lhc.buffer(100, .25))
+		for i = 1,#b do
+			assert.is_true(math.abs(b[i] - 1) < 1e-3)
+		end
+	end)
+end)
+
+describe("Noise", function()
+	it("is reproducible for a given seed", function()
+		local a = lhc.noise.white(100000, 42)
+		local b = lhc.noise.white(100000, 42)
+		assert.are.same({a:get(1,1000)}, {b:get(1,1000)})
+		assert.are.same({a:get(-1000,-1)}, {b:get(-1000,-1)})
+	end)
+
+	it("does not depend on the number of threads", function()
+		local threads = lhc.threads()
+		lhc.threads(1)
+		local a = lhc.noise.gaussian(100000, 0, 1, 23)
+		lhc.threads(4)
+		local b = lhc.noise.gaussian(100000, 0, 1, 23)
+		lhc.threads(threads)
+		assert.are.same({a:get(-1000,-1)}, {b:get(-1000,-1)})
+	end)
+
+	it("has independent streams", function()
+		local a = lhc.noise.white(100, 42, 1)
+		local b = lhc.noise.white(100, 42, 2)
+		assert.are_not.same({a:get(1,-1)}, {b:get(1,-1)})
+	end)
+
+	it("stays in range", function()
+		local b = lhc.noise.uniform(10000, 2, 3, 1)
+		for i = 1,#b do
+			assert.is_true(b[i] >= 2 and b[i] < 3)
+		end
+	end)
+
+	it("colors noise", function()
+		assert.are.equals(#lhc.noise.pink(1000, 1), 1000)
+		assert.are.equals(#lhc.noise.brown(1000, 1), 1000)
+
+		-- mean power per DFT bin of 16 segments of 1024 samples
+		local function power(b, k0, k1)
+			local p = 0
+			for s = 0,15 do
+				for k = k0,k1-1 do
+					local re, im = 0, 0
+					for i = 0,1023 do
+						local a = 2 * math.pi * k * i / 1024
+						local x = b[s * 1024 + i + 1]
+						re, im = re + x * math.cos(a), im + x * math.sin(a)
+					end
+					p = p + re * re + im * im
+				end
+			end
+			return p / (16 * (k1 - k0))
+		end
+
+		-- power in a band three octaves below another: flat for white
+		-- noise, -3 dB per octave for pink and -6 dB per octave for brown
+		local function ratio(b) return power(b, 16, 24) / power(b, 128, 192) end
+		local white = ratio(lhc.noise.white(16384, 3))
+		local pink  = ratio(lhc.noise.pink(16384, 3))
+		local brown = ratio(lhc.noise.brown(16384, 3))
+		assert.is_true(white > .5 and white < 2)
+		assert.is_true(pink > 4 and pink < 16)
+		assert.is_true(brown > 30)
+	end)
+
+	it("provides seeded random number generators", function()
+		local r1, r2 = lhc.noise.rng(5), lhc.noise.rng(5)
+		for i = 1,10 do
+			assert.are.equals(r1:uniform(), r2:uniform())
+			assert.are.equals(r1:gaussian(), r2:gaussian())
+		end
+	end)
+end)
+
+describe("Mixing", function()
+	local a = lhc.buffer{1,2,3}
+	local b = lhc.buffer{10,20}
+
+	it("sums buffers", function()
+		assert.are.same({11,22,3}, {lhc.mix(a, b):get(1,-1)})
+	end)
+
+	it("applies gains and offsets", function()
+		local c = lhc.mix({a, 2}, {b, .5, 4})
+		assert.are.same({2,4,6,0,5,10}, {c:get(1,-1)})
+	end)
+
+	it("clips negative offsets", function()
+		local c = lhc.mix({a, 1, -1})
+		assert.are.same({2,3}, {c:get(1,-1)})
+	end)
+
+	it("mixes many long stems", function()
+		local stems = {}
+		for i = 1,64 do
+			stems[i] = {lhc.buffer(100000, 1), 1/64, i}
+		end
+		local c = lhc.mix(unpack(stems))
+		assert.are.equals(#c, 100064)
+		assert.are.equals(c[1], 0)
+		assert.are.equals(c[50000], 1)
+		assert.are.equals(c[100064], 1/64)
+	end)
+end)
+
+describe("Timelines", function()
+	it("places events at sample accurate positions", function()
+		local tl = lhc.timeline(10)
+		tl:place(lhc.buffer{1,1}, .2)
+		tl:place(lhc.buffer{2}, .3, .5)
+		assert.are.equals(#tl, 2)
+		assert.are.equals(tl:length(), .4)
+		assert.are.same({0,0,1,2}, {tl:render():get(1,-1)})
+	end)
+
+	it("renders time ranges", function()
+		local tl = lhc.timeline(10)
+		tl:place(lhc.buffer{1,2,3,4}, .1)
+		assert.are.same({2,3}, {tl:render(.2, .4):get(1,-1)})
+		assert.are.same({4,0,0}, {tl:render(.4, .7):get(1,-1)})
+	end)
+
+	it("handles interleaved channels", function()
+		local tl = lhc.timeline(10, 2)
+		tl:place(lhc.buffer{1,-1,2,-2}, .1)
+		assert.are.same({0,0,1,-1,2,-2}, {tl:render():get(1,-1)})
+		assert.has_error(function() tl:place(lhc.buffer{1,2,3}, 0) end)
+	end)
+
+	it("matches mixing many events", function()
+		local tl = lhc.timeline(44100)
+		local click = lhc.buffer(100, 1)
+		local sources = {}
+		for i = 1,1000 do
+			tl:place(click, i * .01, .25)
+			sources[i] = {click, .25, i * 441}
+		end
+		assert.are.same({lhc.mix(unpack(sources)):get(1,-1)}, {tl:render():get(1,-1)})
+	end)
+
+	it("mixes long events with short ones", function()
+		local tl = lhc.timeline(44100)
+		local drone = lhc.buffer(44100 * 11, function(i) return math.sin(i) end)
+		local click = lhc.buffer(100, 1)
+		tl:place(drone, 0, .5)
+		local sources = {{drone, .5, 0}}
+		for i = 1,1000 do
+			tl:place(click, i * .01, .25)
+			sources[i+1] = {click, .25, i * 441}
+		end
+		local mixed = lhc.mix(unpack(sources))
+		assert.are.same({mixed:get(1,-1)}, {tl:render():get(1,-1)})
+		assert.are.same({mixed:get(44101, 88200)}, {tl:render(1, 2):get(1,-1)})
+	end)
+
+	it("can be cleared", function()
+		local tl = lhc.timeline()
+		tl:place(lhc.buffer{1}, 1)
+		tl:clear()
+		assert.are.equals(#tl, 0)
+		assert.are.equals(#tl:render(), 0)
+	end)
+end)
+
+describe("Unit generators", function()
+	it("renders block by block", function()
+		local src = lhc.ugen.buffer(lhc.buffer{1,2,3,4,5})
+		assert.are.same({1,2,3}, {src:render(3):get(1,-1)})
+		assert.are.same({4,5,0}, {src:render(3):get(1,-1)})
+		local loop = lhc.ugen.buffer(lhc.buffer{1,2}, true)
+		assert.are.same({1,2,1,2,1}, {loop:render(5):get(1,-1)})
+	end)
+
+	it("combines nodes with arithmetic", function()
+		local a = lhc.ugen.buffer(lhc.buffer{1,2,3})
+		local n = (a + 1) * a - a / 2
+		assert.are.same({1.5,5,10.5}, {n:render(3):get(1,-1)})
+		assert.are.same({-1}, {(-lhc.ugen.buffer(lhc.buffer{1})):render(1):get(1,-1)})
+	end)
+
+	it("evaluates shared nodes once per block", function()
+		local noise = lhc.ugen.noise(42)
+		local out = (noise - noise):render(1000)
+		assert.are.same({0,0,0,0}, {out:get(1,4)})
+		assert.are.same({lhc.ugen.noise(7):render(600):get(1,-1)},
+		                {(lhc.ugen.noise(7) * 1):render(600):get(1,-1)})
+	end)
+
+	it("has oscillators and envelopes", function()
+		local s = lhc.ugen.sine(441, 44100):render(51)
+		assert.is_true(math.abs(s[26] - 1) < 1e-6)
+		assert.are.same({0,.5,1,.5,0,0}, {lhc.ugen.env({0,1,0}, {.2,.2}, 10):render(6):get(1,-1)})
+		local sq = lhc.ugen.square(1, .25, 4):render(4)
+		assert.are.same({1,-1,-1,-1}, {sq:get(1,-1)})
+	end)
+
+	it("can modulate parameters with nodes", function()
+		local freq = lhc.ugen.buffer(lhc.buffer(1000, 441), true)
+		local a = lhc.ugen.sine(freq, 44100):render(1000)
+		local b = lhc.ugen.sine(441, 44100):render(1000)
+		assert.are.same({a:get(1,-1)}, {b:get(1,-1)})
+	end)
+
+	it("filters signals", function()
+		local dc = lhc.ugen.buffer(lhc.buffer(5000, 1), true)
+		local lp = lhc.ugen.lowpass(dc, 100, 44100):render(5000)
+		local hp = lhc.ugen.highpass(dc, 100, 44100):render(5000)
+		assert.is_true(math.abs(lp[5000] - 1) < 1e-3)
+		assert.is_true(math.abs(hp[5000]) < 1e-3)
+	end)
+
+	it("streams into and out of files", function()
+		local path = os.tmpname() .. ".wav"
+		lhc.ugen.buffer(lhc.buffer{0,.5,-.5,.25}):write(path, 4, 44100)
+		local n = lhc.ugen.file(path)
+		assert.are.same({0,.5,-.5,.25,0}, {n:render(5):get(1,-1)})
+		os.remove(path)
+	end)
+
+	it("keeps the sample rate of the operands", function()
+		local path = os.tmpname() .. ".wav"
+		local sine = lhc.ugen.sine(440, 48000)
+		for _, node in ipairs{sine * .5, .5 + sine, -sine} do
+			node:write(path, 16)
+			assert.are.equals(select(2, lhc.soundfile.read(path)), 48000)
+		end
+		os.remove(path)
+		assert.has_error(function() return sine * lhc.ugen.sine(440, 44100) end)
+
+		-- sources take a rate, filters inherit the rate of their input
+		local mix = sine + lhc.ugen.noise(1, 48000) * lhc.ugen.buffer(lhc.buffer{1}, true, 48000)
+		mix:write(path, 16)
+		assert.are.equals(select(2, lhc.soundfile.read(path)), 48000)
+		lhc.ugen.lowpass(mix, 1000):write(path, 16)
+		assert.are.equals(select(2, lhc.soundfile.read(path)), 48000)
+		os.remove(path)
+		assert.has_error(function() return lhc.ugen.lowpass(sine, 1000, 44100) end)
+		assert.has_error(function() return lhc.ugen.highpass(sine, lhc.ugen.sine(1, 44100)) end)
+
+		-- coefficients follow the rate: 1 kHz at 48 kHz equals 2 kHz at 96 kHz
+		local dc48 = lhc.ugen.buffer(lhc.buffer(64, 1), true, 48000)
+		local dc96 = lhc.ugen.buffer(lhc.buffer(64, 1), true, 96000)
+		assert.are.same({lhc.ugen.lowpass(dc48, 1000):render(64):get(1,-1)},
+		                {lhc.ugen.lowpass(dc96, 2000):render(64):get(1,-1)})
+	end)
+end)
+
+describe("Overviews", function()
+	local function reference(buf, i, j)
+		local lo, hi, sq = math.huge, -math.huge, 0
+		for k = i,j do
+			lo, hi, sq = math.min(lo, buf[k]), math.max(hi, buf[k]), sq + buf[k]^2
+		end
+		return lo, hi, math.sqrt(sq / (j - i + 1))
+	end
+
+	it("answers peak queries", function()
+		local buf = lhc.buffer(100000, function(i) return math.sin(i * .37) * (i % 1000) / 1000 end)
+		local ov = buf:overview()
+		assert.are.equals(#ov, 100000)
+		assert.are.equals(ov, buf:overview())
+
+		local lo, hi, rms = ov:peaks(1234, 98765, 7)
+		assert.are.same({7, 7, 7}, {#lo, #hi, #rms})
+		local len = 98765 - 1234 + 1
+		for k = 0,6 do
+			local a = 1234 + math.floor(k * len / 7)
+			local b = 1234 + math.floor((k + 1) * len / 7) - 1
+			local rlo, rhi, rrms = reference(buf, a, b)
+			assert.are.equals(lo[k+1], rlo)
+			assert.are.equals(hi[k+1], rhi)
+			assert.is_true(math.abs(rms[k+1] - rrms) < 1e-5)
+		end
+	end)
+
+	it("covers the whole buffer by default", function()
+		local ov = lhc.buffer{1, -2, 3, -4}:overview()
+		assert.are.same({-4}, {select(1, ov:peaks(1)):get(1,-1)})
+		assert.are.same({3}, {select(2, ov:peaks(1)):get(1,-1)})
+		assert.are.same({1, -2, 3, -4}, {select(2, ov:peaks(4)):get(1,-1)})
+		assert.has_error(function() ov:peaks(0, 10, 1) end)
+	end)
+
+	it("can be updated", function()
+		local buf = lhc.buffer(1000, 0)
+		local ov = buf:overview()
+		buf[500] = 1
+		ov:update()
+		assert.are.equals(select(2, ov:peaks(1))[1], 1)
+	end)
+
+	it("persists next to a soundfile", function()
+		local buf = lhc.buffer(5000, function(i) return (i % 7) / 8 end)
+		lhc.soundfile.write(buf, "overview.wav", 44100, 1)
+		local data = lhc.soundfile.read("overview.wav")
+		local ov = data:overview("overview.wav")
+		local f = io.open("overview.wav.overview", "rb")
+		assert.is_not_nil(f)
+		f:close()
+
+		local again = lhc.soundfile.read("overview.wav"):overview("overview.wav")
+		assert.are.same({select(2, ov:peaks(10)):get(1,-1)}, {select(2, again:peaks(10)):get(1,-1)})
+		os.remove("overview.wav")
+		os.remove("overview.wav.overview")
+	end)
+end)
+
+describe("Memoization", function()
+	lhc.memo.dir = os.tmpname() .. "-memo"
+
+	it("hashes buffers", function()
+		local a = lhc.buffer{1, 2, 3}
+		assert.are.equals(#a:hash(), 16)
+		assert.are.equals(a:hash(), lhc.buffer{1, 2, 3}:hash())
+		assert.are_not.equals(a:hash(), lhc.buffer{1, 2, 4}:hash())
+		assert.are_not.equals(a:hash(), a:hash(1))
+	end)
+
+	it("skips unchanged stages", function()
+		local calls = 0
+		local function stage(x)
+			calls = calls + 1
+			return lhc.buffer(100, x), 48000, 2
+		end
+
+		local input = lhc.buffer{1, 2, 3}
+		local a, rate, channels = lhc.memo({"stage", input, .5}, stage, .5)
+		local b, rate2, channels2 = lhc.memo({"stage", input, .5}, stage, .5)
+		assert.are.equals(calls, 1)
+		assert.are.same({a:get(1,-1)}, {b:get(1,-1)})
+		assert.are.same({48000, 2, 48000, 2}, {rate, channels, rate2, channels2})
+
+		lhc.memo({"stage", lhc.buffer{1, 2, 4}, .5}, stage, .5)
+		lhc.memo({"stage", input, "0.5"}, stage, .5)
+		assert.are.equals(calls, 3)
+		assert.has_error(function() lhc.memo({print}, stage, 1) end)
+	end)
+
+	it("evicts old entries", function()
+		local old = lhc.memo.limit
+		lhc.memo.limit = 10000
+		local calls = 0
+		local function big()
+			calls = calls + 1
+			return lhc.buffer(2000, 1)
+		end
+		lhc.memo({"first"}, big)
+		lhc.memo({"second"}, big)
+		lhc.memo({"second"}, big)
+		assert.are.equals(calls, 2)
+		lhc.memo({"first"}, big)
+		assert.are.equals(calls, 3)
+		lhc.memo.limit = old
+	end)
+
+	it("does not return entries of other keys", function()
+		local old = lhc.memo.dir
+		lhc.memo.dir = os.tmpname() .. "-collide"
+		local calls = 0
+		local function stage()
+			calls = calls + 1
+			return lhc.buffer{1, 2, 3}
+		end
+		lhc.memo({"key"}, stage)
+
+		-- pretend a different key hashed to the same file name
+		local ls = io.popen("ls " .. lhc.memo.dir)
+		local name = ls:read("*l")
+		ls:close()
+		lhc.buffer{7}:save(lhc.memo.dir .. "/" .. name, 44100, 1, "some other key")
+
+		local b = lhc.memo({"key"}, stage)
+		assert.are.equals(calls, 2)
+		assert.are.same({1, 2, 3}, {b:get(1,-1)})
+
+		-- the entry was replaced in place, no temporary files remain
+		local files = {}
+		for f in io.popen("ls " .. lhc.memo.dir):lines() do files[#files+1] = f end
+		assert.are.same({name}, files)
+		lhc.memo.dir = old
+	end)
+
+	it("hashes named fields of key parts", function()
+		local calls = 0
+		local function stage(x)
+			calls = calls + 1
+			return lhc.buffer(1, x)
+		end
+
+		assert.are.equals(lhc.memo({"named", {size = .5}}, stage, .5)[1], .5)
+		assert.are.equals(lhc.memo({"named", {size = .9}}, stage, .9)[1], .9)
+		assert.are.equals(calls, 2)
+
+		-- insertion order does not matter
+		local t = {mode = "x"}
+		t.size, t[1] = .5, "a"
+		lhc.memo({"named", {"a", size = .5, mode = "x"}}, stage, 1)
+		lhc.memo({"named", t}, stage, 1)
+		assert.are.equals(calls, 3)
+	end)
 end)
 
 describe("Player tests", function()
@@ -529,6 +1141,229 @@ describe("Player tests", function()
 			sleep(1)
 		end)
 	end)
+
+	it("can tell the playback position", function()
+		local p = lhc.player(seatbelts, 44100, 1)
+		local pos, t = p:tell()
+		assert.are.equal(0, pos)
+		assert.are.equal(0, t)
+
+		p:seekTo(22050)
+		pos, t = p:tell()
+		assert.are.equal(22050, pos)
+		assert.are.equal(0.5, t)
+
+		p:play()
+		sleep(0.2)
+		pos = p:tell()
+		assert.is_true(pos > 22050 and pos < 44100)
+		p:pause()
+		assert.has.errors(function() p:seekTo(44101) end)
+	end)
+
+	it("tells the sample being heard, not the one being rendered", function()
+		-- a latency of many blocks: rendering runs far ahead of the output
+		local p = lhc.player(seatbelts, 44100, 1, {framesPerBuffer = 256, latency = .25})
+		p:play()
+		sleep(0.05)
+		assert.is_true(p:tell() < 44100 * .15)
+		sleep(0.45)
+		local pos = p:tell()
+		p:pause()
+		assert.is_true(pos > 44100 * .3 and pos < 44100 * .6)
+	end)
+
+	it("can change gain and looping while playing", function()
+		local p = lhc.player(seatbelts, 44100, 1)
+		assert.are.equal(1, p:gain())
+		assert.is_false(p:loop())
+		p:play()
+		p:gain(0.25)
+		p:loop(true)
+		sleep(0.2)
+		assert.are.equal(0.25, p:gain())
+		assert.is_true(p:loop())
+		p:pause()
+	end)
+
+	it("can stream files from disk", function()
+		lhc.soundfile.write(seatbelts, "stream-player.wav", 44100, 1)
+		local p = lhc.player.stream("stream-player.wav")
+		local frames, rate, channels = p:info()
+		assert.are.equal(#seatbelts, frames)
+		assert.are.equal(44100, rate)
+		assert.are.equal(1, channels)
+
+		p:seekTo(11025)
+		assert.are.equal(11025, p:tell())
+		p:play()
+		sleep(0.3)
+		assert.is_true(p:tell() > 11025)
+		p:loop(true)
+		p:rewind()
+		sleep(0.3)
+		p:stop()
+		assert.are.equal(0, p:underruns())
+		assert.has.errors(function() p:seekTo(frames + 1) end)
+		os.remove("stream-player.wav")
+	end)
+
+	it("seeks in files longer than the stream buffer without underruns", function()
+		local long = lhc.buffer(44100 * 4, function(i)
+			return math.sin(i/44100 * 2 * math.pi * 220) * .2
+		end)
+		lhc.soundfile.write(long, "stream-long.wav", 44100, 1)
+		local p = lhc.player.stream("stream-long.wav")
+		sleep(0.2) -- let the decoder fill its buffer
+
+		p:seekTo(44100 * 3)
+		assert.are.equal(44100 * 3, p:tell())
+		p:play()
+		sleep(0.2)
+		p:seekTo(44100)
+		sleep(0.2)
+		p:pause()
+		local pos = p:tell()
+		assert.is_true(pos > 44100 and pos < 44100 * 2)
+		assert.are.equal(0, p:underruns())
+		os.remove("stream-long.wav")
+	end)
+
+	it("mixes overlapping voices on one stream", function()
+		local ids = {}
+		for i = 1,20 do
+			ids[i] = lhc.play(seatbelts, 44100, 1, {gain = .1, pan = (i % 3) - 1, offset = i * 100})
+		end
+		assert.are.equal(20, lhc.player.voices())
+		assert.are_not.equal(ids[1], ids[2])
+		sleep(0.3)
+		lhc.player.halt(ids[1])
+		lhc.player.halt()
+		sleep(0.1)
+		assert.are.equal(0, lhc.player.voices())
+		assert.has.errors(function() lhc.play(seatbelts, 44100, 1, {pan = 2}) end)
+		assert.has.errors(function() lhc.play(seatbelts, 44100, 3) end)
+	end)
+
+	it("can queue buffers while playing", function()
+		local blocksize = 4410
+		local function block(k)
+			return seatbelts:sub(k * blocksize + 1, (k+1) * blocksize)
+		end
+
+		local p = lhc.player(block(0), 44100, 1)
+		p:play()
+		for k = 1,9 do
+			assert.is_true(p:queue(block(k)) >= 1)
+			p:wait(2)
+		end
+		assert.is_true(p:queued() <= 3)
+		p:wait()
+		assert.are.equal(0, p:queued())
+		p:pause()
+
+		for k = 1,16 do p:queue(block(0)) end
+		assert.is_false(p:queue(block(0), false))
+		assert.has.errors(function() p:queue(lhc.buffer(0)) end)
+	end)
+
+	it("plays silence while the queue is empty", function()
+		local p = lhc.player(lhc.buffer(441, 0), 44100, 1)
+		p:queue(lhc.buffer(441, 0))
+		p:play()
+		sleep(0.2)
+		-- a late block is an underrun, not the end of playback
+		local late = p:underruns()
+		assert.is_true(late > 0)
+		p:queue(lhc.buffer(4410, 0))
+		p:wait()
+		assert.are.equal(0, p:queued())
+
+		-- after the end of the input, the player completes
+		p:queue(nil)
+		sleep(0.3)
+		local underruns = p:underruns()
+		sleep(0.2)
+		assert.are.equal(underruns, p:underruns())
+		p:pause()
+	end)
+
+	it("reports callback statistics", function()
+		-- engine statistics are only reported once the engine runs
+		lhc.play(seatbelts, 44100, 1, {gain = 0})
+		local p = lhc.player(seatbelts, 44100, 1)
+		p:play()
+		sleep(0.3)
+		p:pause()
+
+		local s = p:stats()
+		assert.is_true(s.callbacks > 0)
+		assert.is_true(s.underflows >= 0 and s.overflows >= 0)
+		assert.is_true(s.max_time >= s.mean_time)
+		assert.is_true(s.latency > 0)
+		assert.are.equal(44100, s.samplerate)
+		assert.is_number(s.cpu_load)
+
+		local n = 0
+		for _, count in ipairs(s.histogram) do n = n + count end
+		assert.are.equal(s.callbacks, n)
+
+		local total = lhc.player.stats()
+		assert.is_true(total.callbacks >= s.callbacks)
+		assert.is_nil(total.cpu_load)
+		assert.is_table(total.engine)
+		lhc.player.halt()
+	end)
+
+	it("can list devices", function()
+		local devices = lhc.player.devices()
+		assert.is_true(#devices > 0)
+		for _, d in ipairs(devices) do
+			assert.is_number(d.index)
+			assert.is_string(d.name)
+			assert.is_string(d.hostapi)
+			assert.is_true(d.low_latency <= d.high_latency)
+		end
+	end)
+
+	it("can choose device and latency", function()
+		local device
+		for _, d in ipairs(lhc.player.devices()) do
+			if d.default then device = d end
+		end
+
+		local p = lhc.player(seatbelts, 44100, 1, {
+			device = device.index, latency = "low", framesPerBuffer = 256
+		})
+		p:play()
+		sleep(0.2)
+		p:pause()
+		assert.is_true(p:stats().latency > 0)
+
+		assert.has_no.errors(function()
+			lhc.player(seatbelts, 44100, 1, {device = device.name, latency = 0.05})
+			lhc.player.engine{latency = "low"}
+		end)
+		assert.has.errors(function()
+			lhc.player(seatbelts, 44100, 1, {device = "no such device"})
+		end)
+		assert.has.errors(function()
+			lhc.player(seatbelts, 44100, 1, {latency = "sometime"})
+		end)
+	end)
+
+	it("runs the engine at a configured sample rate", function()
+		while lhc.player.voices() > 0 do lhc.player.halt(); sleep(0.01) end
+		lhc.player.engine{samplerate = 48000}
+		lhc.play(seatbelts, 48000, 1, {gain = 0})
+		sleep(0.1)
+		assert.are.equal(48000, lhc.player.stats().engine.samplerate)
+		assert.has.errors(function() lhc.player.engine{samplerate = 0} end)
+
+		while lhc.player.voices() > 0 do lhc.player.halt(); sleep(0.01) end
+		lhc.player.engine()
+		assert.are.equal(44100, lhc.player.stats().engine.samplerate)
+	end)
 end)
 
 describe("Soundfile tests", function()
@@ -567,4 +1402,307 @@ describe("Soundfile tests", function()
 			sleep(1)
 		end)
 	end)
+
+	it("streams audio to a file", function()
+		local f = lhc.soundfile.open("stream.wav", "w", 44100, 2, 16)
+		for i = 1,10 do
+			f:write(lhc.buffer{0, .5, -.5, .25})
+		end
+		f:flush()
+		f:close()
+		assert.has_error(function() f:write(lhc.buffer{0,0}) end)
+
+		local b, rate, channels = lhc.soundfile.read("stream.wav")
+		assert.are.equals(#b, 40)
+		assert.are.equals(channels, 2)
+		assert.are.same({0, .5, -.5, .25}, {b:get(37,40)})
+		assert.has_error(function()
+			lhc.soundfile.open("stream.wav", "w", 44100, 2):write(lhc.buffer{1,2,3})
+		end)
+		os.remove("stream.wav")
+	end)
+
+	it("reads audio in chunks", function()
+		local data = lhc.buffer(2000, function(i) return ((i % 64) - 32) / 64 end)
+		lhc.soundfile.write(data, "chunks.wav", 44100, 2, 16)
+
+		local f = lhc.soundfile.open("chunks.wav")
+		assert.are.same({1000, 44100, 2}, {f:info()})
+
+		local frames, last = 0
+		for block, n in f:frames(300) do
+			assert.are.equals(#block, 600)
+			if last then assert.are.equals(last, block) end
+			last, frames = block, frames + n
+		end
+		assert.are.equals(frames, 1000)
+		assert.are.same({0,0}, {last[599], last[600]})
+
+		assert.are.equals(f:seek(990), 990)
+		local b, n = f:read(100)
+		assert.are.equals(n, 10)
+		assert.are.same({data:get(1981,2000)}, {b:get(1,-1)})
+
+		f:seek(0)
+		local dest = lhc.buffer(4)
+		assert.are.equals(select(2, f:read(10, dest)), 2)
+		assert.are.same({data:get(1,4)}, {dest:get(1,-1)})
+
+		-- only the requested frames are padded
+		f:seek(995)
+		local big = lhc.buffer(20, 7)
+		assert.are.equals(select(2, f:read(8, big)), 5)
+		assert.are.same({data:get(1991,2000)}, {big:get(1,10)})
+		assert.are.same({0,0,0,0,0,0, 7,7,7,7}, {big:get(11,20)})
+		assert.has_error(function() f:write(dest) end)
+		f:close()
+		os.remove("chunks.wav")
+	end)
+
+	it("decodes into existing buffers", function()
+		local kick  = lhc.soundfile.encode(lhc.buffer{.5, .25, .125}, "wav", 44100, 1)
+		local snare = lhc.soundfile.encode(lhc.buffer{-.5, -.25}, "wav", 44100, 1)
+		local kit = lhc.buffer(6, 0)
+		assert.are.same({3, 44100, 1}, {lhc.soundfile.decodeinto(kick, kit)})
+		assert.are.same({2, 44100, 1}, {lhc.soundfile.decodeinto(snare, kit, 4)})
+		assert.are.same({.5, .25, .125, -.5, -.25, 0}, {kit:get(1,-1)})
+
+		lhc.soundfile.write(lhc.buffer{.5, -.5, .25, -.25}, "stereo.wav", 44100, 2)
+		assert.are.same({2, 44100, 2}, {lhc.soundfile.readinto("stereo.wav", kit, 4)})
+		assert.are.same({.5, .25, .125, .5, -.5, 0}, {kit:get(1,-1)})
+		assert.has_error(function() lhc.soundfile.readinto("stereo.wav", kit, 8) end)
+		os.remove("stereo.wav")
+	end)
+
+	it("encodes incrementally", function()
+		local block = lhc.buffer{.5, -.5, .25, -.25}
+		local enc = lhc.soundfile.encoder("wav", 44100, 1)
+		for i = 1,100 do enc:write(block) end
+		local data = enc:finish()
+		assert.has_error(function() enc:write(block) end)
+
+		local b, rate, channels = lhc.soundfile.decode(data)
+		assert.are.equals(#b, 400)
+		assert.are.same({block:get(1,-1)}, {b:get(397,400)})
+		assert.are.equals(data, lhc.soundfile.encode(lhc.buffer(400, function(i)
+			return block[(i-1) % 4 + 1]
+		end), "wav", 44100, 1))
+	end)
+
+	it("hands out encoded chunks", function()
+		local enc = lhc.soundfile.encoder("wav", 44100, 1)
+		local chunks = {}
+		for i = 1,10 do
+			enc:write(lhc.buffer(1000, i / 20))
+			chunks[#chunks+1] = enc:chunk()
+		end
+		local rest, patch, pos = enc:finish()
+		chunks[#chunks+1] = rest
+		local data = table.concat(chunks)
+		if patch then
+			data = data:sub(1, pos-1) .. patch .. data:sub(pos + #patch)
+		end
+		local b = lhc.soundfile.decode(data)
+		assert.are.equals(#b, 10000)
+		assert.are.equals(b[10000], .5)
+	end)
+
+	it("processes batches of files", function()
+		local jobs = {}
+		for i = 1,8 do
+			local input = ("batch-in-%d.wav"):format(i)
+			lhc.soundfile.write(lhc.buffer(1000, i / 32), input, 8000, 1)
+			jobs[i] = {input = input, output = ("batch-out-%d.wav"):format(i)}
+		end
+		jobs[4].gain = 2
+		jobs[5].rate = 16000
+		jobs[9] = {input = "does-not-exist.wav", output = "batch-out-9.wav"}
+
+		local calls, last = 0
+		local results = lhc.soundfile.batch(jobs, {normalize = 0, threads = 4,
+			progress = function(done, total)
+				calls, last = calls + 1, done
+				assert.are.equals(total, 9)
+			end})
+
+		assert.is_true(calls > 0)
+		assert.are.equals(last, 9)
+		for i = 1,8 do assert.are.equals(results[i], true) end
+		assert.are.equals(type(results[9]), "string")
+
+		assert.are.equals(lhc.soundfile.read("batch-out-1.wav")[1], 1/32)
+		assert.are.equals(lhc.soundfile.read("batch-out-4.wav")[1], 8/32)
+		local b, rate = lhc.soundfile.read("batch-out-5.wav")
+		assert.are.same({2000, 16000}, {#b, rate})
+
+		jobs[9] = nil
+		lhc.soundfile.batch(jobs, {normalize = .5})
+		assert.are.equals(lhc.soundfile.read("batch-out-2.wav")[1], .5)
+
+		for i = 1,8 do
+			os.remove(jobs[i].input)
+			os.remove(jobs[i].output)
+		end
+	end)
+
+	it("loads files in the background", function()
+		local data = lhc.buffer(100000, function(i) return (i % 100) / 128 end)
+		lhc.soundfile.write(data, "async.wav", 44100, 2)
+
+		local futures = {}
+		for i = 1,4 do futures[i] = lhc.soundfile.read_async("async.wav") end
+		assert.are.equals(type(futures[1]:ready()), "boolean")
+		for i = 1,4 do
+			local b, rate, channels = futures[i]:result()
+			assert.is_true(futures[i]:ready())
+			assert.are.same({100000, 44100, 2}, {#b, rate, channels})
+			assert.are.same({data:get(99990,-1)}, {b:get(99990,-1)})
+		end
+		assert.are.equals(select(1, futures[1]:wait():result()), futures[1]:result())
+
+		assert.has_error(function() lhc.soundfile.read_async("does-not-exist.wav") end)
+		os.remove("async.wav")
+	end)
+
+	it("writes flac and floating point files", function()
+		local data = lhc.buffer(10000, function(i) return math.sin(i / 10) * .75 end)
+
+		local flac = lhc.soundfile.encode(data, "flac", 44100, 1, 24, 1)
+		local wav  = lhc.soundfile.encode(data, "wav", 44100, 1, 24)
+		assert.is_true(#flac < #wav)
+		local b = lhc.soundfile.decode(flac)
+		assert.are.same({lhc.soundfile.decode(wav):get(1,-1)}, {b:get(1,-1)})
+
+		lhc.soundfile.write(data, "float.wav", 44100, 1, "float")
+		assert.are.same({data:get(1,-1)}, {lhc.soundfile.read("float.wav"):get(1,-1)})
+		lhc.soundfile.write(data, "double.wav", 44100, 1, "double")
+		assert.are.same({data:get(1,-1)}, {lhc.soundfile.read("double.wav"):get(1,-1)})
+
+		assert.has_error(function() lhc.soundfile.encode(data, "flac", 44100, 1, "float") end)
+		assert.has_error(function() lhc.soundfile.encode(data, "wav", 44100, 1, "vorbis") end)
+		assert.has_error(function() lhc.soundfile.encode(data, "wav", 44100, 1, "nonsense") end)
+		assert.has_error(function() lhc.soundfile.encode(data, "flac", 44100, 1, 16, 2) end)
+		os.remove("float.wav")
+		os.remove("double.wav")
+	end)
+
+	it("encodes streams on a separate thread", function()
+		local f = lhc.soundfile.open("stream.flac", "w", 44100, 2, 16, .5)
+		local block = lhc.buffer(2048, function(i) return (i % 2 == 0) and .5 or -.5 end)
+		for i = 1,100 do f:write(block) end
+		f:flush()
+		for i = 1,100 do f:write(block) end
+		f:close()
+
+		local b, rate, channels = lhc.soundfile.read("stream.flac")
+		assert.are.same({409600, 44100, 2}, {#b, rate, channels})
+		assert.are.same({-.5, .5}, {b:get(-2,-1)})
+		os.remove("stream.flac")
+	end)
+
+	it("converts to 16 and 24 bit with dither and clipping", function()
+		local data = lhc.buffer{.5, -.5, 1.5, -1.5, 1/32768, 0}
+		local b = lhc.soundfile.decode(lhc.soundfile.encode(data, "wav", 44100, 1, 16))
+		assert.are.same({.5, -.5, 32767/32768, -1, 1/32768, 0}, {b:get(1,-1)})
+
+		local soft = lhc.soundfile.decode(lhc.soundfile.encode(data, "wav", 44100, 1, 24, {clip = "soft"}))
+		assert.are.equals(soft[1], .5)
+		assert.is_true(soft[3] < 1 and soft[3] > .9)
+		assert.are.equals(soft[4], -soft[3])
+
+		-- dither linearizes: a quarter LSB survives on average
+		local quiet = lhc.buffer(20000, .25 / 32768)
+		for _, mode in ipairs{"tpdf", "shaped"} do
+			local d = lhc.soundfile.decode(lhc.soundfile.encode(quiet, "wav", 44100, 1, 16,
+				{dither = mode, seed = 1}))
+			local sum = 0
+			for i = 1,#d do sum = sum + d[i] end
+			assert.is_true(math.abs(sum / #d * 32768 - .25) < .05)
+		end
+		local plain = lhc.soundfile.decode(lhc.soundfile.encode(quiet, "wav", 44100, 1, 16))
+		assert.are.equals(plain[1], 0)
+
+		assert.are.equals(
+			lhc.soundfile.encode(quiet, "wav", 44100, 1, 16, {dither = "tpdf", seed = 7}),
+			lhc.soundfile.encode(quiet, "wav", 44100, 1, 16, {dither = "tpdf", seed = 7}))
+		assert.has_error(function() lhc.soundfile.encode(quiet, "wav", 44100, 1, "float", {dither = "tpdf"}) end)
+		assert.has_error(function() lhc.soundfile.encode(quiet, "wav", 44100, 1, 16, {dither = "bogus"}) end)
+	end)
+
+	it("resamples batches without aliasing", function()
+		-- 30 kHz is above the new nyquist frequency and must not fold back to 14.1 kHz
+		local input = lhc.buffer(96000, function(i) return .5 * math.sin((i-1) * 2 * math.pi * 30000 / 96000) end)
+		lhc.soundfile.write(input, "batch-hi.wav", 96000, 1)
+		assert.is_true(lhc.soundfile.batch({{input = "batch-hi.wav", output = "batch-lo.wav", rate = 44100}})[1])
+
+		local b, rate = lhc.soundfile.read("batch-lo.wav")
+		assert.are.same({44100, 44100}, {#b, rate})
+		local energy = 0
+		for i = 1000,#b-1000 do energy = energy + b[i] * b[i] end
+		assert.is_true(math.sqrt(energy / (#b - 2000)) < 1e-3)
+		os.remove("batch-hi.wav")
+		os.remove("batch-lo.wav")
+	end)
+
+	it("dithers batch and ugen output like encode", function()
+		local quiet = lhc.buffer(5000, .25 / 32768)
+		local opts = {dither = "tpdf", seed = 7}
+		local ref = lhc.soundfile.decode(lhc.soundfile.encode(quiet, "wav", 44100, 1, 16, opts))
+
+		lhc.soundfile.write(quiet, "dither-in.wav", 44100, 1)
+		local results = lhc.soundfile.batch({{input = "dither-in.wav", output = "dither-batch.wav"}},
+			{bits = 16, dither = "tpdf", seed = 7})
+		assert.is_true(results[1])
+		lhc.ugen.buffer(quiet):write("dither-ugen.wav", #quiet, 44100, 16, opts)
+
+		for _, path in ipairs{"dither-batch.wav", "dither-ugen.wav"} do
+			local b = lhc.soundfile.read(path)
+			assert.are.equals(#ref, #b)
+			for i = 1,#b do assert.are.equals(ref[i], b[i]) end
+			os.remove(path)
+		end
+		assert.has_error(function()
+			lhc.ugen.buffer(quiet):write("dither-ugen.wav", 10, 44100, "float", opts)
+		end)
+		os.remove("dither-in.wav")
+	end)
+
+	it("caches decoded files", function()
+		lhc.soundfile.write(lhc.buffer{.5, -.5, .25}, "cached.wav", 44100, 1)
+		lhc.soundfile.cache(1024 * 1024)
+		local _, _, _, hits, misses = lhc.soundfile.cache()
+
+		local a = lhc.soundfile.read("cached.wav")
+		local b, rate, channels = lhc.soundfile.read("cached.wav")
+		assert.are.same({.5, -.5, .25}, {b:get(1,-1)})
+		assert.are.same({44100, 1}, {rate, channels})
+		b[1] = 0
+		assert.are.equals(lhc.soundfile.read("cached.wav")[1], .5)
+
+		local used, budget, entries, h, m = lhc.soundfile.cache()
+		assert.are.same({1024 * 1024, 1, hits + 2, misses + 1}, {budget, entries, h, m})
+		assert.is_true(used > 0)
+
+		lhc.soundfile.cache(0)
+		assert.are.same({0, 0}, {(lhc.soundfile.cache()), select(3, lhc.soundfile.cache())})
+		os.remove("cached.wav")
+	end)
+
+	it("finds each of many cached files", function()
+		lhc.soundfile.cache(1024 * 1024)
+		for i = 1,100 do
+			lhc.soundfile.write(lhc.buffer{i / 128}, ("cached-%d.wav"):format(i), 44100, 1)
+			lhc.soundfile.read(("cached-%d.wav"):format(i))
+		end
+		local _, _, entries, hits = lhc.soundfile.cache()
+		assert.are.equals(entries, 100)
+
+		for i = 100,1,-1 do
+			assert.are.equals(lhc.soundfile.read(("cached-%d.wav"):format(i))[1], i / 128)
+		end
+		assert.are.equals(select(4, lhc.soundfile.cache()), hits + 100)
+
+		lhc.soundfile.cache(0)
+		for i = 1,100 do os.remove(("cached-%d.wav"):format(i)) end
+	end)
 end)